@@ -0,0 +1,114 @@
+// This class implements a page cache shared by every run and leveled block in
+// the tree. Pages are keyed by (file id, page index) and kept in LRU order.
+// The cache is split into shards, each with its own lock, so concurrent gets
+// hitting different pages rarely contend.
+#pragma once
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "key_value.h"
+
+// one page as it sits on disk: sorted pairs followed by the delete bitmap.
+struct CachedPage {
+  size_t size = 0;  // valid bytes; the last page of a file may be short.
+  char data[LOAD_MEMORY_PAGE_SIZE];
+};
+
+class BlockCache {
+  static const int SHARD_CNT = 16;
+
+  typedef std::pair<uint64_t, std::shared_ptr<const CachedPage>> LruItem;
+
+  struct Shard {
+    std::mutex mutex;
+    std::list<LruItem> lru;  // most recently used at the front
+    std::unordered_map<uint64_t, std::list<LruItem>::iterator> index;
+  };
+
+  size_t max_pages;
+  size_t shard_capacity;
+  Shard shards[SHARD_CNT];
+
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+
+  static uint64_t cache_key(uint64_t file_id, uint32_t page) {
+    return (file_id << 32) | page;
+  }
+
+  Shard& shard_for(uint64_t key) {
+    // mix the bits so consecutive pages of one file spread over shards.
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return shards[key % SHARD_CNT];
+  }
+
+ public:
+  // capacity is counted in pages. A capacity of 0 disables caching.
+  explicit BlockCache(size_t capacity)
+      : max_pages(capacity),
+        shard_capacity((capacity + SHARD_CNT - 1) / SHARD_CNT) {}
+
+  BlockCache(const BlockCache&) = delete;
+  BlockCache& operator=(const BlockCache&) = delete;
+
+  // returns the cached page or nullptr, and records a hit or a miss.
+  std::shared_ptr<const CachedPage> lookup(uint64_t file_id, uint32_t page) {
+    if (max_pages == 0) {
+      return nullptr;
+    }
+    uint64_t key = cache_key(file_id, page);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      misses++;
+      return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    hits++;
+    return it->second->second;
+  }
+
+  void insert(uint64_t file_id,
+              uint32_t page,
+              std::shared_ptr<const CachedPage> data) {
+    if (max_pages == 0) {
+      return;
+    }
+    uint64_t key = cache_key(file_id, page);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      it->second->second = data;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      return;
+    }
+
+    shard.lru.emplace_front(key, data);
+    shard.index[key] = shard.lru.begin();
+
+    // pages of deleted files are never looked up again and age out here.
+    while (shard.lru.size() > shard_capacity) {
+      shard.index.erase(shard.lru.back().first);
+      shard.lru.pop_back();
+    }
+  }
+
+  size_t capacity() const { return max_pages; }
+  uint64_t hit_count() const { return hits; }
+  uint64_t miss_count() const { return misses; }
+};
+
+#endif
@@ -0,0 +1,242 @@
+// Variable-length record blocks for the string tables (see string_table.h).
+// A block holds sorted records followed by its restart array:
+//   [record]...[record][uint32 restart offset]...[uint32 restart count]
+//   record = [varint shared][varint unshared]
+//            [varint value_len << 2 | indirect << 1 | del]
+//            [unshared key bytes][value bytes]
+// An indirect value is a pointer into the value log (see value_log.h).
+// Each key is stored as the length of the prefix it shares with the key
+// before it plus the bytes that differ. Every RESTART_INTERVAL records the
+// full key is stored again and its offset pushed to the restart array, so a
+// seek binary searches the restart points and then scans at most one
+// interval of records.
+#pragma once
+#ifndef BLOCK_FORMAT_H
+#define BLOCK_FORMAT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "key_value.h"
+#include "run_file.h"
+
+namespace block_format {
+
+inline void put_varint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// decode a varint at p, never reading at or past limit. Returns the byte
+// after it, or nullptr if the varint is truncated.
+inline const char* get_varint(const char* p, const char* limit,
+                              uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift <= 63 && p < limit; shift += 7) {
+    uint64_t byte = static_cast<unsigned char>(*p++);
+    result |= (byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      *value = result;
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+inline void put_fixed32(std::string& out, uint32_t value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline uint32_t get_fixed32(const char* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+}  // namespace block_format
+
+class BlockBuilder {
+  int restart_interval;
+  std::string buffer;
+  std::vector<uint32_t> restarts{0};
+  int since_restart = 0;
+  std::string last_key;
+  bool has_entries = false;
+
+ public:
+  static const int RESTART_INTERVAL = 16;
+
+  explicit BlockBuilder(int restart_interval = RESTART_INTERVAL)
+      : restart_interval(restart_interval) {}
+
+  // keys must be added in strictly increasing order.
+  void add(const std::string& key, const std::string& val, bool del,
+           bool indirect = false) {
+    size_t shared = 0;
+    if (since_restart < restart_interval) {
+      size_t max_shared = std::min(last_key.size(), key.size());
+      while (shared < max_shared && last_key[shared] == key[shared]) {
+        shared++;
+      }
+    } else {
+      restarts.push_back(buffer.size());
+      since_restart = 0;
+    }
+
+    block_format::put_varint(buffer, shared);
+    block_format::put_varint(buffer, key.size() - shared);
+    block_format::put_varint(
+        buffer, (val.size() << 2) | (indirect ? 2 : 0) | (del ? 1 : 0));
+    buffer.append(key, shared, std::string::npos);
+    buffer.append(val);
+
+    last_key = key;
+    since_restart++;
+    has_entries = true;
+  }
+
+  bool empty() const { return !has_entries; }
+
+  // size of the block if it were finished now.
+  size_t size_estimate() const {
+    return buffer.size() + (restarts.size() + 1) * sizeof(uint32_t);
+  }
+
+  // append the restart array and return the block. The builder is reset.
+  std::string finish() {
+    for (uint32_t offset : restarts) {
+      block_format::put_fixed32(buffer, offset);
+    }
+    block_format::put_fixed32(buffer, restarts.size());
+    std::string block;
+    block.swap(buffer);
+    restarts.assign(1, 0);
+    since_restart = 0;
+    last_key.clear();
+    has_entries = false;
+    return block;
+  }
+};
+
+// Walks the records of one block. The block contents are shared, so copies
+// of an iterator stay valid after the table that read the block moves on.
+// Records that do not decode throw CorruptionError.
+class BlockIterator {
+  std::shared_ptr<const std::string> contents;
+  const char* data = nullptr;
+  uint32_t records_end = 0;  // start of the restart array
+  uint32_t restart_cnt = 0;
+
+  uint32_t cur = 0;   // offset of the current record
+  uint32_t next_offset = 0;  // offset of the record after it
+  std::string cur_key;
+  std::string cur_val;
+  bool cur_del = false;
+  bool cur_indirect = false;
+
+  uint32_t restart_point(uint32_t i) const {
+    return block_format::get_fixed32(data + records_end +
+                                     i * sizeof(uint32_t));
+  }
+
+  [[noreturn]] static void corrupt() {
+    throw CorruptionError("Malformed record in string table block");
+  }
+
+  // decode the record at offset, whose key shares a prefix with cur_key.
+  void parse(uint32_t offset) {
+    const char* p = data + offset;
+    const char* limit = data + records_end;
+    uint64_t shared, unshared, val_tag;
+    p = block_format::get_varint(p, limit, &shared);
+    if (p) p = block_format::get_varint(p, limit, &unshared);
+    if (p) p = block_format::get_varint(p, limit, &val_tag);
+    uint64_t val_len = val_tag >> 2;
+    if (!p || shared > cur_key.size() ||
+        static_cast<uint64_t>(limit - p) < unshared + val_len) {
+      corrupt();
+    }
+    cur_key.resize(shared);
+    cur_key.append(p, unshared);
+    cur_val.assign(p + unshared, val_len);
+    cur_del = val_tag & 1;
+    cur_indirect = val_tag & 2;
+    cur = offset;
+    next_offset = (p - data) + unshared + val_len;
+  }
+
+  void seek_to_restart(uint32_t i) {
+    cur_key.clear();
+    next_offset = restart_point(i);
+    cur = records_end;
+  }
+
+ public:
+  BlockIterator() {}
+
+  explicit BlockIterator(std::shared_ptr<const std::string> block)
+      : contents(std::move(block)) {
+    data = contents->data();
+    size_t size = contents->size();
+    if (size < sizeof(uint32_t)) {
+      corrupt();
+    }
+    restart_cnt = block_format::get_fixed32(data + size - sizeof(uint32_t));
+    if (restart_cnt == 0 ||
+        restart_cnt > (size - sizeof(uint32_t)) / sizeof(uint32_t)) {
+      corrupt();
+    }
+    records_end = size - (restart_cnt + 1) * sizeof(uint32_t);
+    cur = next_offset = records_end;
+  }
+
+  bool valid() const { return cur < records_end; }
+  const std::string& key() const { return cur_key; }
+  const std::string& value() const { return cur_val; }
+  bool deleted() const { return cur_del; }
+  bool indirect() const { return cur_indirect; }
+
+  void seek_to_first() {
+    seek_to_restart(0);
+    next();
+  }
+
+  void next() {
+    if (next_offset >= records_end) {
+      cur = next_offset = records_end;
+      return;
+    }
+    parse(next_offset);
+  }
+
+  // position at the first record with a key >= key.
+  void seek(const std::string& key) {
+    // the last restart point whose key is < key; the record sought is in its
+    // interval or at the start of the next one.
+    uint32_t lo = 0, hi = restart_cnt - 1;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi + 1) / 2;
+      seek_to_restart(mid);
+      next();
+      if (!valid() || cur_key < key) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    seek_to_restart(lo);
+    next();
+    while (valid() && cur_key < key) {
+      next();
+    }
+  }
+};
+
+#endif
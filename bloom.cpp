@@ -1,4 +1,6 @@
 #include "bloom.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 // Selection of hash functions inspired by https://llimllib.github.io/bloomfilter-tutorial/
 
@@ -10,8 +12,9 @@ uint32_t BloomFilter::hash_1(KEY_t k) const {
     const int32_t Offset  = 0x811C9DC5; 
     int32_t hash = Offset; 
 
-    for (int i = 0; i < 4; ++i) {
-        uint8_t byte = (k >> (i * 8)) & 0xFF; // Extract byte from the integer
+    auto bits = static_cast<std::make_unsigned<KEY_t>::type>(k);
+    for (size_t i = 0; i < sizeof(KEY_t); ++i) {
+        uint8_t byte = (bits >> (i * 8)) & 0xFF; // Extract byte from the integer
         hash ^= byte;                            // XOR the bottom with the current byte
         hash *= Prime;                       // Multiply by the FNV prime
     }
@@ -22,7 +25,7 @@ uint32_t BloomFilter::hash_1(KEY_t k) const {
 // Hash-2: murmur3
 // Modified from https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
 uint32_t BloomFilter::hash_2(KEY_t k) const {
-    int32_t key = k;
+    KEY_t key = k;
     uint32_t seed = 42; //arbiturary seed 
     uint32_t hash = MurmurHash3_x86_32(&key, sizeof(key), seed);
 
@@ -32,29 +35,137 @@ uint32_t BloomFilter::hash_2(KEY_t k) const {
 // Hash-3: xxhash 
 // Acquired from: http://cyan4973.github.io/xxHash/
 uint32_t BloomFilter::hash_3(KEY_t k) const {
-    int32_t key = k;
+    KEY_t key = k;
     uint32_t seed = 42; //arbiturary seed 
     uint32_t hash = XXHash32::hash(&key, sizeof(key), seed);
 
     return hash % bitarray.size();
 }
 
-// Public Functions
-// This funciton manipulates the bits for the bitarray
-void BloomFilter::set(KEY_t key) {
+// 64 bit hash for the blocked filter: the murmur3 fmix64 finalizer.
+// Bits 32-63 pick the block, bits 0-15 and 16-31 drive the double hashing
+// inside the block, so the three uses never share input bits.
+uint64_t BloomFilter::hash_64(KEY_t k) const {
+    uint64_t hash =
+        static_cast<std::make_unsigned<KEY_t>::type>(k) ^ 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+// FNV-1a, murmur3 and xxhash over the bytes of a string key.
+uint32_t BloomFilter::hash_1(const std::string& key) const {
+    uint32_t hash = 0x811C9DC5;
+    for (unsigned char byte : key) {
+        hash ^= byte;
+        hash *= 0x01000193;
+    }
+    return hash % bitarray.size();
+}
+
+uint32_t BloomFilter::hash_2(const std::string& key) const {
+    return MurmurHash3_x86_32(key.data(), key.size(), 42) % bitarray.size();
+}
+
+uint32_t BloomFilter::hash_3(const std::string& key) const {
+    return XXHash32::hash(key.data(), key.size(), 42) % bitarray.size();
+}
+
+// two murmur3 hashes with different seeds: the first picks the block, the
+// second drives the probes inside it.
+uint64_t BloomFilter::hash_64(const std::string& key) const {
+    uint64_t block_hash = MurmurHash3_x86_32(key.data(), key.size(), 0x9E3779B9);
+    uint64_t probe_hash = MurmurHash3_x86_32(key.data(), key.size(), 42);
+    return (block_hash << 32) | probe_hash;
+}
+
+int BloomFilter::probes_for(float bits_per_entry) {
+    int probes = static_cast<int>(std::lround(bits_per_entry * std::log(2.0)));
+    return std::clamp(probes, 1, MAX_PROBE_CNT);
+}
+
+// round the requested bit count up to a power of two number of blocks.
+long BloomFilter::blocked_length(long length) {
+    long blocks = 1;
+    while (blocks * BLOCK_BITS < length) {
+        blocks <<= 1;
+    }
+    return blocks * BLOCK_BITS;
+}
+
+template <typename K>
+void BloomFilter::set_key(const K& key) {
+    if (type == BLOCKED) {
+        uint64_t hash = hash_64(key);
+        size_t base = ((hash >> 32) & block_mask) * BLOCK_BITS;
+        uint32_t h1 = hash & 0xFFFF;
+        uint32_t h2 = ((hash >> 16) & 0xFFFF) | 1;
+        for (int i = 0; i < probe_cnt; i++) {
+            bitarray.set(base + ((h1 + i * h2) & (BLOCK_BITS - 1)));
+        }
+        return;
+    }
+
     bitarray.set(hash_1(key));
     bitarray.set(hash_2(key));
     bitarray.set(hash_3(key));
-};
+}
+
+template <typename K>
+bool BloomFilter::test_key(const K& key) const {
+    if (type == BLOCKED) {
+        uint64_t hash = hash_64(key);
+        size_t base = ((hash >> 32) & block_mask) * BLOCK_BITS;
+        uint32_t h1 = hash & 0xFFFF;
+        uint32_t h2 = ((hash >> 16) & 0xFFFF) | 1;
+        for (int i = 0; i < probe_cnt; i++) {
+            if (!bitarray.test(base + ((h1 + i * h2) & (BLOCK_BITS - 1)))) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-// This funciton Check the bits for the bitarray
-bool BloomFilter::is_set(KEY_t key) const {
     return (bitarray.test(hash_1(key))
          && bitarray.test(hash_2(key))
          && bitarray.test(hash_3(key)));
-};
+}
+
+// Public Functions
+// This funciton manipulates the bits for the bitarray
+void BloomFilter::set(KEY_t key) { set_key(key); }
+
+void BloomFilter::set(const std::string& key) { set_key(key); }
+
+// This funciton Check the bits for the bitarray
+bool BloomFilter::is_set(KEY_t key) const { return test_key(key); }
+
+bool BloomFilter::is_set(const std::string& key) const { return test_key(key); }
+
+static_assert(sizeof(BitArray::block_type) == sizeof(uint64_t),
+              "bloom filter words are stored as 64 bit blocks");
+
+BloomFilter::BloomFilter(const std::vector<uint64_t>& words, size_t bit_cnt,
+                         Type type, int probe_cnt)
+    : bitarray(bit_cnt), type(type), probe_cnt(probe_cnt) {
+    boost::from_block_range(words.begin(),
+                            words.begin() + bitarray.num_blocks(), bitarray);
+    if (type == BLOCKED) {
+        block_mask = bitarray.size() / BLOCK_BITS - 1;
+    }
+}
+
+std::vector<uint64_t> BloomFilter::to_words() const {
+    std::vector<uint64_t> words(bitarray.num_blocks());
+    boost::to_block_range(bitarray, words.begin());
+    return words;
+}
 
-boost::dynamic_bitset<> BloomFilter::return_bitarray(){
+BitArray BloomFilter::return_bitarray(){
     return bitarray;
 }
 int BloomFilter::return_bitarray_size() {
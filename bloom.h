@@ -3,25 +3,106 @@
 #define BLOOM_H
 
 #include <boost/dynamic_bitset.hpp>
+#include <cstdint>
+#include <new>
+#include <string>
 #include "lib/xxhash32.h"
 #include "lib/murmur3.h"
 
 #include "key_value.h"
 
+// puts the filter words on cache line boundaries, so each 512 bit block of a
+// BLOCKED filter is exactly one cache line.
+template <typename T>
+struct CacheLineAllocator {
+    typedef T value_type;
+    static const size_t ALIGNMENT = 64;
+
+    CacheLineAllocator() = default;
+    template <typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(ALIGNMENT));
+    }
+
+    template <typename U>
+    bool operator==(const CacheLineAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheLineAllocator<U>&) const { return false; }
+};
+
+typedef boost::dynamic_bitset<uint64_t, CacheLineAllocator<uint64_t>> BitArray;
+
 class BloomFilter {
+public:
+    // CLASSIC probes three independent hashes across the whole bit array.
+    // BLOCKED keeps every probe of a key inside one 512 bit (64 byte) block,
+    // derived from a single 64 bit hash, with a power of two block count.
+    // Its probe count follows the bits per entry (see probes_for).
+    enum Type { CLASSIC, BLOCKED };
+
+    static const int BLOCK_BITS = 512;
+    static const int DEFAULT_PROBE_CNT = 3;
+    // past about 8 probes a blocked filter gets worse, not better: keys
+    // crowd into blocks, so the extra bits set cost more than they filter.
+    static const int MAX_PROBE_CNT = 8;
+
+    // probes that minimize the false positive rate at this many bits per
+    // entry, bits * ln 2, within 1..MAX_PROBE_CNT.
+    static int probes_for(float bits_per_entry);
+
+private:
     // the underlying representation of this should be a bit array. 
-    boost::dynamic_bitset<> bitarray;
+    BitArray bitarray;
+    Type type;
+    size_t block_mask = 0;  // block count - 1, only used by BLOCKED.
+    int probe_cnt;          // only used by BLOCKED; CLASSIC always probes 3.
 
     // hash functions for bloom filter.
     uint32_t hash_1(KEY_t) const;
     uint32_t hash_2(KEY_t) const;
     uint32_t hash_3(KEY_t) const;
+    uint64_t hash_64(KEY_t) const;
+
+    // the same hashes over the bytes of a string key.
+    uint32_t hash_1(const std::string&) const;
+    uint32_t hash_2(const std::string&) const;
+    uint32_t hash_3(const std::string&) const;
+    uint64_t hash_64(const std::string&) const;
+
+    template <typename K> void set_key(const K& key);
+    template <typename K> bool test_key(const K& key) const;
+
+    static long blocked_length(long length);
 
 public:
     // constructor
-    BloomFilter(long length) : bitarray(length) {}
+    BloomFilter(long length, Type type = CLASSIC,
+                int probe_cnt = DEFAULT_PROBE_CNT)
+        : bitarray(type == BLOCKED ? blocked_length(length) : length),
+          type(type),
+          probe_cnt(probe_cnt) {
+        if (type == BLOCKED) {
+            block_mask = bitarray.size() / BLOCK_BITS - 1;
+        }
+    }
 
-    BloomFilter(boost::dynamic_bitset<> input_bitarray): bitarray(input_bitarray) {}
+    BloomFilter(BitArray input_bitarray, Type type = CLASSIC,
+                int probe_cnt = DEFAULT_PROBE_CNT)
+        : bitarray(input_bitarray), type(type), probe_cnt(probe_cnt) {
+        if (type == BLOCKED) {
+            block_mask = bitarray.size() / BLOCK_BITS - 1;
+        }
+    }
+
+    // rebuild a filter from the 64 bit words written by to_words().
+    BloomFilter(const std::vector<uint64_t>& words, size_t bit_cnt,
+                Type type = CLASSIC, int probe_cnt = DEFAULT_PROBE_CNT);
 
     // set bit in bitarray
     void set(KEY_t);
@@ -29,10 +110,20 @@ public:
     // check bit in bitarray
     bool is_set(KEY_t) const;
 
+    // string keys, for the string tables.
+    void set(const std::string&);
+    bool is_set(const std::string&) const;
+
     // return copy of bitarray; 
-    boost::dynamic_bitset<> return_bitarray(); 
+    BitArray return_bitarray(); 
 
     int return_bitarray_size(); 
+
+    // the bitarray as 64 bit words, lowest bits first, for storing on disk.
+    std::vector<uint64_t> to_words() const;
+
+    Type return_type() const { return type; }
+    int return_probe_cnt() const { return probe_cnt; }
 };
 
 #endif
\ No newline at end of file
@@ -10,152 +10,226 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
 #include <vector>
 
 #include "bloom.h"
 #include "key_value.h"
 #include "lib/ThreadPool.h"
 
-// The buffer level uses the CPP map library, which is implemented as black red
-// tree.
+// The buffer level is a skiplist sorted by key. Every key appears at most once:
+// an update or delete overwrites the entry that is already in the list, so the
+// buffer never holds stale versions and can be flushed in order without a
+// sort. Readers share a lock, writers take it exclusively.
 
 class BufferLevel {
+  static const int MAX_HEIGHT = 12;  // enough for ~16M keys with p = 1/4
+
+  struct Node {
+    Entry_t entry;
+    int height;
+    Node* next[MAX_HEIGHT];
+
+    Node(Entry_t e, int h) : entry(e), height(h) {
+      std::fill(next, next + MAX_HEIGHT, nullptr);
+    }
+  };
+
   int max_size;  // memory limit allocated at the buffer level
   int current_size = 0;
 
- public:
-  // constructor
-  std::vector<Entry_t> store;
-  BufferLevel(int size) : max_size(size) { max_size = size; };
+  Node* head;
+  int height = 1;
+  std::mt19937 rng;
+  mutable std::shared_mutex mutex;
+
+  int random_height() {
+    int h = 1;
+    while (h < MAX_HEIGHT && (rng() & 3) == 0) {
+      h++;
+    }
+    return h;
+  }
+
+  // returns the first node whose key is >= key. When prev is given, it is
+  // filled with the last node before that position on every level.
+  Node* find_greater_or_equal(KEY_t key, Node** prev) const {
+    Node* cur = head;
+    for (int lvl = height - 1; lvl >= 0; lvl--) {
+      while (cur->next[lvl] && cur->next[lvl]->entry.key < key) {
+        cur = cur->next[lvl];
+      }
+      if (prev) {
+        prev[lvl] = cur;
+      }
+    }
+    return cur->next[0];
+  }
+
+  // insert or overwrite an entry. Overwriting an existing key never needs
+  // room, so only new keys are rejected when the buffer is full.
+  int upsert(const Entry_t& entry) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return upsert_locked(entry);
+  }
+
+  // upsert() for a caller that already holds the lock exclusively.
+  int upsert_locked(const Entry_t& entry) {
+    Node* prev[MAX_HEIGHT];
+    Node* found = find_greater_or_equal(entry.key, prev);
+
+    if (found && found->entry.key == entry.key) {
+      found->entry = entry;
+      return 0;
+    }
 
-  int insert(KEY_t key, VALUE_t val) {
     if (current_size >= max_size) {
       return -1;
     }
 
-    Entry_t entry{key, val, false};
-    store.push_back(entry);
+    int h = random_height();
+    if (h > height) {
+      for (int lvl = height; lvl < h; lvl++) {
+        prev[lvl] = head;
+      }
+      height = h;
+    }
+
+    Node* node = new Node(entry, h);
+    for (int lvl = 0; lvl < h; lvl++) {
+      node->next[lvl] = prev[lvl]->next[lvl];
+      prev[lvl]->next[lvl] = node;
+    }
     current_size++;
 
     return 0;
+  }
+
+  void free_nodes() {
+    Node* cur = head->next[0];
+    while (cur) {
+      Node* tmp = cur->next[0];
+      delete cur;
+      cur = tmp;
+    }
+    std::fill(head->next, head->next + MAX_HEIGHT, nullptr);
+  }
+
+ public:
+  // constructor
+  BufferLevel(int size) : max_size(size), rng(std::random_device{}()) {
+    head = new Node(Entry_t{0, 0, false}, MAX_HEIGHT);
+  };
+
+  ~BufferLevel() {
+    free_nodes();
+    delete head;
+  }
+
+  BufferLevel(const BufferLevel&) = delete;
+  BufferLevel& operator=(const BufferLevel&) = delete;
+
+  int insert(KEY_t key, VALUE_t val) {
+    Entry_t entry{key, val, false};
+    return upsert(entry);
   };
 
   //overload for easy loading memory
-  int insert(Entry_t entry) {
-    if (current_size >= max_size) {
+  int insert(Entry_t entry) { return upsert(entry); };
+
+  // apply a group of puts and deletes in order under one lock, so readers see
+  // either none or all of them. Returns -1 without applying anything when the
+  // new keys of the batch do not fit in the remaining room.
+  int insert_batch(const std::vector<Entry_t>& entries) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::vector<KEY_t> new_keys;
+    for (const auto& entry : entries) {
+      Node* found = find_greater_or_equal(entry.key, nullptr);
+      if (!found || found->entry.key != entry.key) {
+        new_keys.push_back(entry.key);
+      }
+    }
+    std::sort(new_keys.begin(), new_keys.end());
+    int new_cnt =
+        std::unique(new_keys.begin(), new_keys.end()) - new_keys.begin();
+    if (current_size + new_cnt > max_size) {
       return -1;
     }
 
-    store.push_back(entry);
-    current_size++;
-
+    for (const auto& entry : entries) {
+      upsert_locked(entry);
+    }
     return 0;
-  };
+  }
 
   // Deletion is done as write with an additional flag.
   int del(KEY_t key) {
-    if (current_size >= max_size) {
-      return -1;
-    }
-
     Entry_t entry{key, 0, true};
-    store.push_back(entry);
-    current_size++;
-
-    return 0;
+    return upsert(entry);
   }
 
-  // search for a key and return value. Update and deletion are done during
-  // compaction.
-  std::unique_ptr<Entry_t> get(KEY_t key, typename std::vector<Entry_t>::reverse_iterator reverse_it, int search_size ) {
-    // core intuitation - the last item is the latest value. We report the
-    // latest no matter what.
-    auto front = reverse_it + search_size;
-    
-    for (auto rit = reverse_it; rit != front; ++rit) {
-      if (rit->key == key) {
-        return std::make_unique<Entry_t>(*rit);
-      }
+  // search for a key and return its entry. A deleted key is returned with the
+  // del flag set so that it shadows older values on disk.
+  std::unique_ptr<Entry_t> get(KEY_t key) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    Node* found = find_greater_or_equal(key, nullptr);
+
+    if (found && found->entry.key == key) {
+      return std::make_unique<Entry_t>(found->entry);
     }
 
     return nullptr;
   }
 
-  // Get a range of values stored in the tree.
-  std::vector<Entry_t> get_range(KEY_t lower, KEY_t upper) {
-    std::unordered_map<KEY_t, Entry_t> hash_mp;
+  // Get a range of values stored in the tree, in key order. Deleted entries are
+  // kept so the caller can use them to hide older values.
+  std::vector<Entry_t> get_range(KEY_t lower, KEY_t upper) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
     std::vector<Entry_t> ret;
 
-    for (int i = 0; i < store.size(); i++) {
-      Entry_t temp_entry = store[i];
-      if (temp_entry.key >= lower && temp_entry.key <= upper) {
-        if (temp_entry.del) {
-          // delete item exists on same level, remove the item.
-          if (hash_mp.find(temp_entry.key) != hash_mp.end()) {
-            hash_mp.erase(temp_entry.key);
-          } else {  // delete item not exists on same level. proprogate.
-            hash_mp[temp_entry.key] = temp_entry;
-          }
-        } else {  // this operation will always use a later key/val to update
-                  // output value.
-          hash_mp[temp_entry.key] = temp_entry;
-        }
-      }
+    Node* cur = find_greater_or_equal(lower, nullptr);
+    while (cur && cur->entry.key <= upper) {
+      ret.push_back(cur->entry);
+      cur = cur->next[0];
     }
-    for (const auto &pair : hash_mp) {
-      ret.push_back(pair.second);
-    }
-    
+
     return ret;
   }
 
   // clean content in the buffer. Used when pushing to next level.
   void clear_buffer(void) {
-    store.clear();
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    free_nodes();
+    height = 1;
     current_size = 0;
   };
 
   // function returns the current size of the buffer level memory.
-  int size(void) { return current_size; }
+  int size(void) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return current_size;
+  }
 
   /*
   flush_buffer() - The function flushes the content into a vector format.
 
-  During the flush process, updates and deletes that can be detected in the
-  buffer will be resolved.
-
-  The algo is essentially the same as range, without testing value range.
+  Updates and deletes are already resolved on insert, so this is a single walk
+  over the bottom level of the skiplist and the result is sorted by key.
   */
-  std::vector<Entry_t> flush_buffer() {
-    std::unordered_map<KEY_t, Entry_t> hash_mp;
+  std::vector<Entry_t> flush_buffer() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
     std::vector<Entry_t> ret;
-    
-    for (int i = 0; i < store.size(); i++) {
-      Entry_t temp_entry = store[i];
-
-      if (temp_entry.del) {
-        // delete item exists on same level, remove the item.
-        if (hash_mp.find(temp_entry.key) != hash_mp.end()) {
-          hash_mp.erase(temp_entry.key);
-        } else {  // delete item not exists on same level. proprogate.
-          hash_mp[temp_entry.key] = temp_entry;
-        }
-      } else {  // this operation will always use a later key/val to update
-                // output value.
-        hash_mp[temp_entry.key] = temp_entry;
-      }
-    }
-    for (const auto &pair : hash_mp) {
-      ret.push_back(pair.second);
-    }
-    
-  
+    ret.reserve(current_size);
 
-    std::sort(ret.begin(), ret.end());
+    for (Node* cur = head->next[0]; cur; cur = cur->next[0]) {
+      ret.push_back(cur->entry);
+    }
 
     return ret;
   }
 };
 
-#endif
\ No newline at end of file
+#endif
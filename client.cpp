@@ -1,11 +1,48 @@
 // g++ -std=c++17 -o client client.cpp -pthread
 #include <chrono>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include "lib/httplib.h"
 
+// longest /status long poll the client asks for; the server caps it at 30 s.
+const int status_wait_ms = 30000;
+
+// loads and ranges can outlast any single request, so they are queued on
+// /post and awaited through /status instead of the synchronous /command.
+bool is_long_running(const std::string& input) {
+  std::istringstream iss(input);
+  std::string command;
+  iss >> command;
+  return command == "l" || command == "r" || command == "R";
+}
+
+// queue a command and long poll until it finishes. Returns false if the
+// server could not be reached.
+bool run_async(httplib::Client& cli, const std::string& input,
+               std::string* result) {
+  auto res = cli.Post("/post", input, "text/plain");
+  if (!res) {
+    return false;
+  }
+  std::string url = "/status?id=" + res->body +
+                    "&wait=" + std::to_string(status_wait_ms);
+  while (true) {
+    auto status = cli.Get(url.c_str());
+    if (!status) {
+      return false;
+    }
+    if (status->body != "Processing") {
+      *result = status->body;
+      return true;
+    }
+  }
+}
+
 int main() {
   httplib::Client cli("127.0.0.1", 8080);
+  // a long poll holds the response for up to status_wait_ms.
+  cli.set_read_timeout(std::chrono::milliseconds(status_wait_ms + 5000));
 
   while (true) {
     std::string input;
@@ -16,40 +53,31 @@ int main() {
       continue;  // Skip empty input
     }
 
-    auto res = cli.Post("/post", input, "text/plain");
-    if (res) {
-      if (input == "q") {
-        break;
+    // /command answers in the response itself, so there is no task id to
+    // poll for.
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string body;
+    bool ok;
+    if (is_long_running(input)) {
+      ok = run_async(cli, input, &body);
+    } else {
+      auto res = cli.Post("/command", input, "text/plain");
+      ok = static_cast<bool>(res);
+      if (res) {
+        body = res->body;
       }
-
-      auto start = std::chrono::high_resolution_clock::now();
-      std::cout << "Response from server: " << res->body << std::endl;
-
-      std::this_thread::sleep_for(std::chrono::milliseconds(200));
-      std::string task_id = res->body;
-      // periodically check for results
-      while (true) {
-        std::string url = "/status?id=" + task_id;
-        auto get_res = cli.Get(url.c_str());
-
-        if (get_res->body == "Processing" ||
-            get_res->body == "Task ID not found") {
-          std::cout << "waiting for server.." << std::endl;
-          std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        } else if (get_res->body == "shutdown" ||
-                   get_res->body == "shutdown-c") {
-          std::cout << "Shutting down client..." << std::endl;
-          return 0;  // Exit the client loop
-        } else {
-          std::cout << get_res->body << std::endl;
-
-          auto end = std::chrono::high_resolution_clock::now();
-          auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-              end - start);
-          std::cout << duration.count() << " milliseconds." << std::endl;
-          break;
-        }
+    }
+    if (ok) {
+      if (body == "shutdown" || body == "shutdown-c") {
+        std::cout << "Shutting down client..." << std::endl;
+        return 0;  // Exit the client loop
       }
+      std::cout << body << std::endl;
+
+      auto end = std::chrono::high_resolution_clock::now();
+      auto duration =
+          std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+      std::cout << duration.count() << " milliseconds." << std::endl;
     } else {
       std::cout << "Failed to connect or other error occurred.\n";
     }
@@ -0,0 +1,411 @@
+// Building blocks for streaming merges, used by compactions and range scans.
+// Inputs are read one page at a time through MergeSource, MergingIterator
+// walks them in key order keeping only the newest version of each key, and
+// RunWriter writes a merge result page by page while it builds the fence
+// pointers and bloom filter. Memory is bounded by one page per input plus one
+// output page.
+#pragma once
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bloom.h"
+#include "crc32c.h"
+#include "key_value.h"
+#include "page_codec.h"
+#include "page_search.h"
+#include "rate_limiter.h"
+#include "run_file.h"
+
+// A sorted input to a merge: either entries already in memory (a flushed
+// buffer) or the pages of one or more files read back to back, such as a run
+// or the blocks of a leveling level. Only the current page is held in memory.
+class MergeSource {
+  struct Segment {
+    std::shared_ptr<RunFile> file;
+    std::vector<KEY_t> fence_pointers;
+  };
+
+  const std::vector<Entry_t>* vec = nullptr;
+  std::vector<Segment> segments;  // files in key order
+
+  size_t seg_idx = 0;
+  int page_idx = 0;  // next page of the current segment to load
+  std::vector<Entry_t> page_entries;
+  size_t pos = 0;  // position in vec or page_entries
+
+  // pages starting after upper_bound are never read.
+  KEY_t upper_bound = MAX_KEY;
+  RateLimiter* limiter = nullptr;  // charged for every page read, if set
+
+  // readahead for long scans: once pages are read back to back, the pages
+  // ahead are prefetched in a window that doubles up to MAX_READAHEAD_PAGES.
+  static const int MIN_READAHEAD_PAGES = 8;
+  static const int MAX_READAHEAD_PAGES = 128;
+  int sequential_pages = 0;
+  int readahead_pages = 0;
+  int readahead_end = 0;  // first page of the segment not prefetched yet
+
+  void readahead(const RunFile& file) {
+    if (++sequential_pages < 2 || page_idx < readahead_end) {
+      return;
+    }
+    readahead_pages = std::min(
+        std::max(readahead_pages * 2, MIN_READAHEAD_PAGES), MAX_READAHEAD_PAGES);
+    int end = std::min(page_idx + readahead_pages, file.page_count());
+    file.prefetch(file.page_offset(page_idx),
+                  file.page_offset(end) - file.page_offset(page_idx));
+    readahead_end = page_idx + readahead_pages;
+  }
+
+  void load_next_page() {
+    page_entries.clear();
+    pos = 0;
+    char page[LOAD_MEMORY_PAGE_SIZE];
+    while (page_entries.empty() && seg_idx < segments.size()) {
+      const Segment& segment = segments[seg_idx];
+      if (page_idx >= segment.file->page_count()) {
+        // end of this file, move to the next one.
+        seg_idx++;
+        page_idx = 0;
+        readahead_end = 0;
+        continue;
+      }
+      if (segment.fence_pointers[page_idx] > upper_bound) {
+        seg_idx = segments.size();  // the rest of the source is out of range.
+        return;
+      }
+      if (limiter) {
+        limiter->request(segment.file->stored_size(page_idx));
+      }
+      size_t page_bytes = segment.file->read_page(page_idx, page);
+      page_idx++;
+      readahead(*segment.file);
+      page_collect_range(page, page_bytes, MIN_KEY, MAX_KEY, page_entries);
+    }
+  }
+
+ public:
+  KEY_t lower = 0;  // smallest key of the source
+  KEY_t upper = 0;  // largest key of the source
+
+  explicit MergeSource(const std::vector<Entry_t>& entries) : vec(&entries) {
+    if (!entries.empty()) {
+      lower = entries.front().key;
+      upper = entries.back().key;
+    }
+  }
+
+  MergeSource(std::shared_ptr<RunFile> run_file,
+              const std::vector<KEY_t>& fence_pointers) {
+    add_segment(run_file, fence_pointers);
+  }
+
+  MergeSource() {}
+
+  // append a file whose keys are all larger than those already added.
+  void add_segment(std::shared_ptr<RunFile> run_file,
+                   const std::vector<KEY_t>& fence_pointers) {
+    if (fence_pointers.empty()) {
+      return;
+    }
+    if (segments.empty()) {
+      lower = fence_pointers.front();
+    }
+    upper = fence_pointers.back();
+    segments.push_back({run_file, fence_pointers});
+  }
+
+  // stop reading pages whose first key is larger than key.
+  void set_upper_bound(KEY_t key) { upper_bound = key; }
+
+  void set_rate_limiter(RateLimiter* rate_limiter) { limiter = rate_limiter; }
+
+  // position the source at its first entry with a key >= key.
+  void seek(KEY_t key) {
+    if (vec) {
+      pos = std::lower_bound(vec->begin(), vec->end(), Entry_t{key, 0, false}) -
+            vec->begin();
+      return;
+    }
+
+    // skip whole files that end before key; they are sorted and disjoint.
+    seg_idx = std::partition_point(segments.begin(), segments.end(),
+                                   [key](const Segment& segment) {
+                                     return segment.fence_pointers.back() < key;
+                                   }) -
+              segments.begin();
+    page_idx = 0;
+    sequential_pages = 0;
+    readahead_pages = 0;
+    readahead_end = 0;
+    if (seg_idx < segments.size()) {
+      // start at the page whose fence range holds key.
+      const std::vector<KEY_t>& fence = segments[seg_idx].fence_pointers;
+      auto it = std::upper_bound(fence.begin(), fence.end() - 1, key);
+      if (it != fence.begin()) {
+        page_idx = (it - fence.begin()) - 1;
+      }
+    }
+
+    load_next_page();
+    while (valid() && entry().key < key) {
+      next();
+    }
+  }
+
+  bool valid() const {
+    return vec ? pos < vec->size() : pos < page_entries.size();
+  }
+
+  const Entry_t& entry() const {
+    return vec ? (*vec)[pos] : page_entries[pos];
+  }
+
+  void next() {
+    pos++;
+    if (!vec && pos >= page_entries.size()) {
+      load_next_page();
+    }
+  }
+
+  // upper bound on the entries this source yields, for sizing filters.
+  size_t size_estimate() const {
+    if (vec) {
+      return vec->size();
+    }
+    size_t pages = 0;
+    for (auto& segment : segments) {
+      pages += segment.file->page_count();
+    }
+    return pages * PAGE_ENTRY_CNT;
+  }
+};
+
+/**
+ * MergingIterator
+ * Walks a set of sorted sources in key order with a min-heap holding one
+ * position per source. sources[0] is the newest; when several sources hold a
+ * key only the entry from the newest one is visible, deleted or not.
+ */
+class MergingIterator {
+  // (key, source index); the smallest key comes first, then the newest source.
+  typedef std::pair<KEY_t, size_t> HeapItem;
+
+  std::vector<MergeSource> sources;
+  std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>>
+      heap;
+
+ public:
+  // sources never read pages that start after upper_bound.
+  explicit MergingIterator(std::vector<MergeSource> merge_sources,
+                           KEY_t upper_bound = MAX_KEY)
+      : sources(std::move(merge_sources)) {
+    for (auto& src : sources) {
+      src.set_upper_bound(upper_bound);
+    }
+    seek(MIN_KEY);
+  }
+
+  // position at the first key >= key.
+  void seek(KEY_t key) {
+    heap = decltype(heap)();
+    for (size_t i = 0; i < sources.size(); i++) {
+      sources[i].seek(key);
+      if (sources[i].valid()) {
+        heap.push({sources[i].entry().key, i});
+      }
+    }
+  }
+
+  bool valid() const { return !heap.empty(); }
+
+  const Entry_t& entry() const { return sources[heap.top().second].entry(); }
+
+  // move past the current key, skipping its older versions.
+  void next() {
+    KEY_t key = heap.top().first;
+    while (!heap.empty() && heap.top().first == key) {
+      size_t idx = heap.top().second;
+      heap.pop();
+      sources[idx].next();
+      if (sources[idx].valid()) {
+        heap.push({sources[idx].entry().key, idx});
+      }
+    }
+  }
+};
+
+// merge sorted sources into sink in key order, keeping only the newest
+// version of each key. When the output is the oldest data for its keys,
+// drop_tombstones also drops deleted entries, since there is nothing left
+// below them to hide. Page reads are charged to limiter when one is given.
+template <typename Sink>
+void merge_sources(std::vector<MergeSource>& sources,
+                   Sink&& sink,
+                   bool drop_tombstones = false,
+                   RateLimiter* limiter = nullptr) {
+  for (auto& src : sources) {
+    src.set_rate_limiter(limiter);
+  }
+  MergingIterator it(std::move(sources));
+  for (; it.valid(); it.next()) {
+    if (!drop_tombstones || !it.entry().del) {
+      sink(it.entry());
+    }
+  }
+}
+
+// total size_estimate() of a set of sources.
+inline size_t sources_size_estimate(const std::vector<MergeSource>& sources) {
+  size_t total = 0;
+  for (auto& src : sources) {
+    total += src.size_estimate();
+  }
+  return total;
+}
+
+/**
+ * RunWriter
+ * Writes sorted entries in the on-disk page format: PAGE_ENTRY_CNT (key, val)
+ * pairs followed by a 64 bit delete bitmap where bit (63 - i) flags entry i. The
+ * last page may be short, with its bitmap right after its last pair. The
+ * first key of every page is pushed to the fence pointers, plus the largest
+ * key once the writer is finished. The filter, fences and a CRC32C per page
+ * then follow the pages, with a RunFooter at the end of the file. With
+ * PAGE_PACKED every page is encoded by page_pack() and its offset is kept.
+ */
+class RunWriter {
+  std::ofstream out;
+  BloomFilter* bloom;  // nullptr for temporary files that need no filter
+  std::vector<KEY_t>* fence_pointers;
+  RateLimiter* limiter;  // charged for every page written, may be nullptr
+  PageFormat format;
+
+  char page[LOAD_MEMORY_PAGE_SIZE];
+  char packed[PACKED_PAGE_BUFFER];
+  int page_cnt = 0;  // entries in the current page
+  uint64_t del_bits = 0;
+  size_t total = 0;
+  size_t data_bytes = 0;
+  std::vector<uint32_t> page_crcs;
+  std::vector<uint64_t> page_offsets;  // only kept for packed pages
+  KEY_t last_key = 0;
+
+  void write_page() {
+    std::memcpy(page + page_cnt * PAGE_ENTRY_SIZE, &del_bits, BOOL_BYTE_CNT);
+    size_t page_bytes = page_cnt * PAGE_ENTRY_SIZE + BOOL_BYTE_CNT;
+    const char* stored = page;
+    if (format == PAGE_PACKED) {
+      page_offsets.push_back(data_bytes);
+      page_bytes = page_pack(page, page_bytes, packed);
+      stored = packed;
+    }
+    if (limiter) {
+      limiter->request(page_bytes);
+    }
+    out.write(stored, page_bytes);
+    data_bytes += page_bytes;
+    page_crcs.push_back(crc32c::value(stored, page_bytes));
+    page_cnt = 0;
+    del_bits = 0;
+  }
+
+ public:
+  RunWriter(const std::string& filename,
+            BloomFilter* bloom,
+            std::vector<KEY_t>* fence_pointers,
+            RateLimiter* limiter = nullptr,
+            PageFormat format = PAGE_RAW)
+      : out(filename, std::ios::binary),
+        bloom(bloom),
+        fence_pointers(fence_pointers),
+        limiter(limiter),
+        format(format) {
+    if (!out.is_open()) {
+      throw std::runtime_error("Unable to open file for writing");
+    }
+  }
+
+  void add(const Entry_t& entry) {
+    if (page_cnt == 0) {
+      fence_pointers->push_back(entry.key);
+    }
+    if (bloom) {
+      bloom->set(entry.key);
+    }
+
+    char* pos = page + page_cnt * PAGE_ENTRY_SIZE;
+    std::memcpy(pos, &entry.key, sizeof(KEY_t));
+    std::memcpy(pos + sizeof(KEY_t), &entry.val, sizeof(VALUE_t));
+    if (entry.del) {
+      del_bits |= static_cast<uint64_t>(1) << (63 - page_cnt);
+    }
+    page_cnt++;
+    total++;
+    last_key = entry.key;
+
+    if (page_cnt == PAGE_ENTRY_CNT) {
+      write_page();
+    }
+  }
+
+  size_t count() const { return total; }
+
+  // write the last partial page, then the bloom filter, fence pointers and
+  // footer, and close the file.
+  void finish() {
+    if (page_cnt > 0) {
+      write_page();
+    }
+    if (total > 0) {
+      fence_pointers->push_back(last_key);
+    }
+
+    RunFooter footer;
+    footer.data_size = data_bytes;
+    footer.page_format = format;
+    footer.entry_cnt = total;
+    footer.fence_cnt = fence_pointers->size();
+    if (total > 0) {
+      footer.min_key = fence_pointers->front();
+      footer.max_key = last_key;
+    }
+    std::string meta;
+    if (bloom) {
+      std::vector<uint64_t> words = bloom->to_words();
+      meta.append(reinterpret_cast<const char*>(words.data()),
+                  words.size() * sizeof(uint64_t));
+      footer.bloom_bits = bloom->return_bitarray_size();
+      footer.bloom_type = bloom->return_type();
+      footer.bloom_probes = bloom->return_probe_cnt();
+    }
+    meta.append(reinterpret_cast<const char*>(fence_pointers->data()),
+                fence_pointers->size() * sizeof(KEY_t));
+    meta.append(reinterpret_cast<const char*>(page_crcs.data()),
+                page_crcs.size() * sizeof(uint32_t));
+    if (format == PAGE_PACKED) {
+      page_offsets.push_back(data_bytes);
+      meta.append(reinterpret_cast<const char*>(page_offsets.data()),
+                  page_offsets.size() * sizeof(uint64_t));
+    }
+    footer.meta_crc = crc32c::value(meta.data(), meta.size());
+    out.write(meta.data(), meta.size());
+    out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Failed to write run file");
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,109 @@
+// This class runs compactions on a worker pool of its own, so they never
+// share a queue with the foreground pool that serves gets. Jobs carry a
+// priority: lower values run first, and jobs of equal priority run in the
+// order they were scheduled. The tree gives compactions of upper levels a
+// lower value because buffer flushes stall behind them.
+#pragma once
+#ifndef COMPACTION_SCHEDULER_H
+#define COMPACTION_SCHEDULER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class CompactionScheduler {
+  struct Job {
+    int priority;
+    uint64_t seq;  // keeps equal priorities in scheduling order
+    std::function<void()> fn;
+
+    bool operator>(const Job& other) const {
+      if (priority != other.priority) {
+        return priority > other.priority;
+      }
+      return seq > other.seq;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  std::priority_queue<Job, std::vector<Job>, std::greater<Job>> jobs;
+  uint64_t next_seq = 0;
+  size_t running = 0;
+  bool stop = false;
+
+  std::mutex mutex;
+  std::condition_variable job_cv;
+  std::condition_variable idle_cv;
+
+  void worker_loop() {
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_cv.wait(lock, [this]() { return stop || !jobs.empty(); });
+        if (jobs.empty()) {
+          return;
+        }
+        job = jobs.top();
+        jobs.pop();
+        running++;
+      }
+
+      try {
+        job.fn();
+      } catch (const std::exception& e) {
+        std::cerr << "Compaction failed: " << e.what() << std::endl;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+      }
+      idle_cv.notify_all();
+    }
+  }
+
+ public:
+  explicit CompactionScheduler(size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+      workers.emplace_back(&CompactionScheduler::worker_loop, this);
+    }
+  }
+
+  // queued jobs still run before the workers exit.
+  ~CompactionScheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    job_cv.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  CompactionScheduler(const CompactionScheduler&) = delete;
+  CompactionScheduler& operator=(const CompactionScheduler&) = delete;
+
+  void schedule(int priority, std::function<void()> fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push({priority, next_seq++, std::move(fn)});
+    }
+    job_cv.notify_one();
+  }
+
+  // block until no job is queued or running. Jobs may schedule follow-up
+  // jobs; those are waited for too.
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle_cv.wait(lock, [this]() { return jobs.empty() && running == 0; });
+  }
+};
+
+#endif
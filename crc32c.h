@@ -0,0 +1,83 @@
+// CRC32C (Castagnoli) checksums for on-disk pages. On x86 CPUs with SSE4.2
+// the crc32 instruction handles 8 bytes per step; elsewhere a byte-wise
+// table is used. Both produce the same value, so files move freely between
+// machines.
+#pragma once
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+namespace crc32c {
+
+inline const uint32_t* table() {
+  static const struct Table {
+    uint32_t entries[256];
+    Table() {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+          crc = (crc >> 1) ^ (0x82F63B78 & (0u - (crc & 1)));  // reflected
+        }
+        entries[i] = crc;
+      }
+    }
+  } crc_table;
+  return crc_table.entries;
+}
+
+inline uint32_t extend_portable(uint32_t crc, const char* data, size_t len) {
+  const uint32_t* entries = table();
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < len; i++) {
+    crc = entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2"))) inline uint32_t extend_sse42(
+    uint32_t crc, const char* data, size_t len) {
+  size_t i = 0;
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; i < len; i++) {
+    crc = _mm_crc32_u8(crc, static_cast<unsigned char>(data[i]));
+  }
+  return crc;
+}
+
+inline bool has_sse42() {
+  static const bool supported = __builtin_cpu_supports("sse4.2");
+  return supported;
+}
+#endif
+
+// checksum of len bytes at data.
+inline uint32_t value(const char* data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+#ifdef CRC32C_X86
+  if (has_sse42()) {
+    return ~extend_sse42(crc, data, len);
+  }
+#endif
+  return ~extend_portable(crc, data, len);
+}
+
+}  // namespace crc32c
+
+#endif
@@ -69,8 +69,8 @@ do
 
                     
                     for file in ./*; do
-                    # Check if the file has a .dat or .txt extension
-                    if [[ "$file" == *.dat ]] || [[ "$file" == *.txt ]]; then
+                    # Check if the file has a .dat, .txt or .log extension
+                    if [[ "$file" == *.dat ]] || [[ "$file" == *.txt ]] || [[ "$file" == *.log ]]; then
                         # If it does, delete the file
                         rm "$file"
                         echo "Deleted: $file"
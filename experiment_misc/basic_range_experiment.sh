@@ -47,8 +47,8 @@ output_file="experiment_results/basic_range_benchmark_gau.txt"
 #                 done 
 
 #                 for file in ./*; do
-#                 # Check if the file has a .dat or .txt extension
-#                 if [[ "$file" == *.dat ]] || [[ "$file" == *.txt ]]; then
+#                 # Check if the file has a .dat, .txt or .log extension
+#                 if [[ "$file" == *.dat ]] || [[ "$file" == *.txt ]] || [[ "$file" == *.log ]]; then
 #                     # If it does, delete the file
 #                     rm "$file"
 #                     echo "Deleted: $file"
@@ -94,8 +94,8 @@ do
                 done 
 
                 for file in ./*; do
-                # Check if the file has a .dat or .txt extension
-                if [[ "$file" == *.dat ]] || [[ "$file" == *.txt ]]; then
+                # Check if the file has a .dat, .txt or .log extension
+                if [[ "$file" == *.dat ]] || [[ "$file" == *.txt ]] || [[ "$file" == *.log ]]; then
                     # If it does, delete the file
                     rm "$file"
                     echo "Deleted: $file"
@@ -0,0 +1,51 @@
+// This class hands out the numbers that name run files. The flush thread
+// and the compaction workers create files at the same time, so the numbers
+// come from one atomic counter and never repeat within a process. At start
+// the counter is moved past every run file already on disk, so a new file
+// cannot reuse the name of one a manifest still refers to.
+#pragma once
+#ifndef FILE_NUMBERS_H
+#define FILE_NUMBERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+class FileNumbers {
+  std::atomic<uint64_t> next{1};
+
+ public:
+  // skip the numbers of the files <prefix><number><extension> in the
+  // working directory. Names that are not a number after the prefix are
+  // ignored.
+  void skip_existing(const std::string& prefix, const std::string& extension) {
+    uint64_t last = 0;
+    for (const auto& file : std::filesystem::directory_iterator("./")) {
+      std::string name = file.path().filename().string();
+      if (name.rfind(prefix, 0) != 0 || file.path().extension() != extension) {
+        continue;
+      }
+      std::string number = name.substr(
+          prefix.size(), name.size() - prefix.size() - extension.size());
+      if (number.empty() || number.size() > 19 ||
+          !std::all_of(number.begin(), number.end(), ::isdigit)) {
+        continue;
+      }
+      last = std::max<uint64_t>(last, std::stoull(number));
+    }
+    uint64_t cur = next.load();
+    while (cur <= last && !next.compare_exchange_weak(cur, last + 1)) {
+    }
+  }
+
+  // a file name no other caller gets.
+  std::string file_name(const std::string& prefix,
+                        const std::string& extension) {
+    return prefix + std::to_string(next++) + extension;
+  }
+};
+
+#endif
@@ -6,28 +6,50 @@
 #define KEY_VALUE_H
 
 #include <math.h>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// The key and value types are picked at build time, so one source tree
+// builds every width, e.g.
+//   g++ -DLSM_KEY_TYPE=int64_t -DLSM_VALUE_TYPE=int64_t ...
+// Keys must be integers. Values may be any trivially copyable type; the
+// command line and server front ends also need them to be streamable.
+#ifndef LSM_KEY_TYPE
+#define LSM_KEY_TYPE int32_t
+#endif
+#ifndef LSM_VALUE_TYPE
+#define LSM_VALUE_TYPE int32_t
+#endif
+
+typedef LSM_KEY_TYPE KEY_t;
+typedef LSM_VALUE_TYPE VALUE_t;
+
+static_assert(std::is_integral<KEY_t>::value, "keys must be integers");
+static_assert(std::is_trivially_copyable<VALUE_t>::value,
+              "values are copied to disk byte for byte");
+
 // These values provide upper and lower bounds of key/value pairs that is
 // supported by our system.
-typedef int32_t KEY_t;
-typedef int32_t VALUE_t;
+const KEY_t MAX_KEY = std::numeric_limits<KEY_t>::max();
+const KEY_t MIN_KEY = std::numeric_limits<KEY_t>::min();
 
-// TODO: need to consider the signed vs unsigned storage spaces. That might be a
-// toggleable choice for later implementation.
-#define MAX_KEY 2147483647
-#define MIN_KEY -2147483648
+const VALUE_t MAX_VAL = std::numeric_limits<VALUE_t>::max();
+const VALUE_t MIN_VAL = std::numeric_limits<VALUE_t>::min();
 
-#define MAX_VAL 2147483647
-#define MIN_VAL -2147483648
-
-const int SAVE_MEMORY_PAGE_SIZE = 512;
-const int LOAD_MEMORY_PAGE_SIZE =
-    SAVE_MEMORY_PAGE_SIZE / 64 + SAVE_MEMORY_PAGE_SIZE;
-const int BOOL_BYTE_CNT = SAVE_MEMORY_PAGE_SIZE / 64;
+// page geometry, derived from the entry size: a page holds PAGE_ENTRY_CNT
+// (key, val) pairs followed by a delete bitmap with one bit per entry.
+const int PAGE_ENTRY_SIZE = sizeof(KEY_t) + sizeof(VALUE_t);
+const int PAGE_ENTRY_CNT = 64;
+const int BOOL_BYTE_CNT = PAGE_ENTRY_CNT / 8;
+const int SAVE_MEMORY_PAGE_SIZE = PAGE_ENTRY_CNT * PAGE_ENTRY_SIZE;
+const int LOAD_MEMORY_PAGE_SIZE = SAVE_MEMORY_PAGE_SIZE + BOOL_BYTE_CNT;
 const int BLOCK_SIZE =
     LOAD_MEMORY_PAGE_SIZE * 100000; 
 
-// basic int32 key/value pair data structure.
+// basic key/value pair data structure.
 struct Entry {
   KEY_t key;
   VALUE_t val;
@@ -48,4 +70,23 @@ struct Entry {
 };
 typedef struct Entry Entry_t;
 
+// a key/value pair of the string tables, where both are byte strings of any
+// length. The integer tree above keeps its fixed-width entries.
+struct StringEntry {
+  std::string key;
+  std::string val;
+  bool del;
+  bool indirect = false;  // val is a value log pointer, not the value
+
+  bool operator<(const StringEntry& other) const { return key < other.key; }
+
+  friend std::ostream& operator<<(std::ostream& os, const StringEntry& entry) {
+    os << "Key: " << entry.key << ", Value: " << entry.val;
+    if (entry.del) {
+      os << " (deleted)";
+    }
+    return os;
+  }
+};
+
 #endif
\ No newline at end of file
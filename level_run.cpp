@@ -1,329 +1,140 @@
 #include "level_run.h"
 
-// this function finds which blocks to insert the buffer values into in a given level.
-void Level_Run::insert_block(std::vector<Entry_t>& buffer) {
-  KEY_t left = buffer[0].key;
-  KEY_t right = buffer.back().key;
-
-  // Find the two bounds
-  Node *prev = nullptr, *cur = root;
-  Node *front = nullptr, *back = nullptr;  // for tracking insert location
-
-  while (cur && !cur->is_empty) {
-    if (cur->lower > left && !front) {  // find left post
-      if (prev && prev->lower <= left) {
-        front = prev;
-      } else {
-        front = root;  // edge case for left smaller than all of the level.
-      }
-    }
-    if (cur->lower > right && !back) {  // find right post
-      if (prev && prev->lower <= right) {
-        back = cur;
-      } else {
-        back = root;  // edge case for right smaller than all of levels.
-      }
-    }
-    prev = cur;
+// this function finds which blocks the incoming sources overlap in this level
+// and writes the blocks that will replace them with the merge of both.
+Level_Run::Splice Level_Run::prepare_insert(std::vector<MergeSource>& incoming,
+                                            bool drop_tombstones) {
+  Splice splice;
+  if (incoming.empty()) {
+    return splice;
+  }
+  KEY_t left = incoming[0].lower;
+  KEY_t right = incoming[0].upper;
+  for (auto& src : incoming) {
+    left = std::min(left, src.lower);
+    right = std::max(right, src.upper);
+  }
+
+  // blocks are sorted and disjoint: skip the ones fully before left, then
+  // every block starting at or before right overlaps the incoming range.
+  Node* cur = root;
+  while (cur && cur->upper < left) {
+    splice.prev = cur;
     cur = cur->next;
   }
-  // check if the last node can be the front node
-  if (prev && !prev->is_empty && prev->upper < right && front == nullptr) {
-    front = prev;
+  if (cur && cur->lower <= right) {
+    splice.first = cur;
   }
-
-  std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> futures;
-  cur = front;
-  while (cur != back) {
-    futures.push_back(pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry_t> {
-      std::vector<Entry_t> temp_vec =
-          load_full_file(cur->file_location, cur->fence_pointers);
-      std::unordered_map<KEY_t, Entry_t> temp_mp;
-      for (auto& entry : temp_vec) {
-        auto it = temp_mp.find(entry.key);
-        if (it == temp_mp.end()) {
-          temp_mp[entry.key] = entry;
-        }
-      }
-      return temp_mp;
-    }));
+  while (cur && cur->lower <= right) {
     cur = cur->next;
   }
-  // merge the new and old blocks.
-  std::unordered_map<KEY_t, Entry_t> hash_mp;
-  for (auto& entry : buffer) {
-    hash_mp[entry.key] = entry;
-  }
-  for (auto& fut : futures) {
-    std::unordered_map<KEY_t, Entry_t> results = fut.get();
-    hash_mp.merge(results);
-  }
+  splice.stop = cur;
 
-  futures.clear();
-  std::vector<Entry_t> ret;
-  // convert back to vectors and sort. -- is there a more efficient way?
-  for (const auto& pair : hash_mp) {
-    ret.push_back(pair.second);
+  // existing blocks are older, so they go after the incoming sources.
+  std::vector<MergeSource> sources(std::move(incoming));
+  if (splice.first) {
+    sources.push_back(chain_source(splice.first, splice.stop));
   }
-  std::sort(ret.begin(), ret.end());
-
-  Node* start_node =
-      save_to_memory(ret);  // create the underlying representation here.
 
-  // store back onto disk format. use front and back to find correct insert
-  // location.
-  Node *insert_start = nullptr, *start_node_chain_end = nullptr,
-       *to_delete = nullptr, *insert_cur = nullptr;
-
-  if (front == back) {
-    if (front == root) {
-      if (root->is_empty) {  // we have a empty level. Just swap and delete.
-        delete root;
-        root = start_node;
-      }
-      // insert everything in front of the linked list.
-      start_node->next = root;
-      root = start_node;
-    } else if (front == nullptr) {
-      if (root->is_empty) {  // this is also the case when you have an empty
-                             // level
-        root = start_node;
-      } else {
-        // insert everything into the back of linked list.'
-        insert_cur = root;
-        while (insert_cur) {
-          insert_cur = insert_cur->next;
-        }
-        insert_cur->next = start_node;
-      }
-    } else {
-      std::cout << "Error in finding overlapping regions" << std::endl;
-    }
-  } else {
-    if (root == front)  // need to replace root node with new node.
-    {
-      to_delete = root;
-      insert_cur = root;
-      root = start_node;
-    } else {
-      insert_start = root;
-      while (insert_start->next != front) {  // go to node before front.
-        insert_start = insert_start->next;
-      }
-      insert_start->next = start_node;
-      to_delete = front;
-      insert_cur = front;
-    }
-
-    while (insert_cur->next != back)  // find the last node that will be merged
-    {
-      insert_cur = insert_cur->next;
-    }
-    insert_cur->next = nullptr;  // cut off the link
+  splice.chain_start = write_blocks(sources, splice.chain_end, drop_tombstones);
+  return splice;
+}
 
-    start_node_chain_end = start_node;  // find end of inserted linked list.
-    while (start_node_chain_end->next != nullptr) {
-      start_node_chain_end = start_node_chain_end->next;
-    }
-    if (back != nullptr) {
-      start_node_chain_end->next = back;  // relink the list
+Level_Run::Node* Level_Run::apply_splice(Splice& splice) {
+  Node* replaced = nullptr;
+  if (splice.first) {
+    replaced = splice.first;
+    Node* tail = replaced;
+    while (tail->next != splice.stop) {
+      tail = tail->next;
     }
+    tail->next = nullptr;  // cut off the link
   }
-  // delete unnecessary files for house keeping
 
-  while (to_delete) {
-    Node* tmp = to_delete->next;
-    delete to_delete;
-    to_delete = tmp;
+  Node* head = splice.stop;
+  if (splice.chain_start) {
+    splice.chain_end->next = splice.stop;
+    head = splice.chain_start;
   }
-}
-
-std::vector<Entry_t> Level_Run::load_full_file(
-    std::string file_name,
-    std::vector<KEY_t>& fence_pointers) {
-  // read-in the the oldest run at the level.
-
-  std::ifstream file(file_name, std::ios::binary);
-  if (!file.is_open())
-    throw std::runtime_error("Unable to open file for loading");
-
-  Entry_t entry;
-  std::vector<Entry_t> buffer;
-
-  file.seekg(0, std::ios::end);
-  size_t fileSize = file.tellg();
-  size_t read_size;
-
-  // read in the run's information.
-  for (int i = 0; i < fence_pointers.size(); i++) {
-    if (i * LOAD_MEMORY_PAGE_SIZE > fileSize) {
-      read_size = fileSize - (i - 1) * LOAD_MEMORY_PAGE_SIZE;
-    } else {
-      read_size = LOAD_MEMORY_PAGE_SIZE;
-    }
-
-    // read in del flags: starting * page_size -> begining of page
-    uint64_t result;
-    file.seekg(i * LOAD_MEMORY_PAGE_SIZE + read_size - BOOL_BYTE_CNT,
-               std::ios::beg);
-    file.read(reinterpret_cast<char*>(&result), BOOL_BYTE_CNT);
-    std::bitset<64> del_flag_bitset(result);
-    file.seekg(0, std::ios::beg);
-
-    file.seekg(i * LOAD_MEMORY_PAGE_SIZE, std::ios::beg);
-
-    int idx = 0;
-    while (read_size > BOOL_BYTE_CNT) {
-      file.read(reinterpret_cast<char*>(&entry.key), sizeof(entry.key));
-      file.read(reinterpret_cast<char*>(&entry.val), sizeof(entry.val));
-
-      entry.del = del_flag_bitset[63 - idx];
-      buffer.push_back(entry);
-
-      read_size = read_size - sizeof(entry.key) - sizeof(entry.val);
-      idx++;
-    }
+  if (splice.prev) {
+    splice.prev->next = head;
+  } else {
+    root = head;
   }
-  file.close();
-  return buffer;
+  return replaced;
 }
 
-// return the first node in the chain that needs to be inserted.
-Level_Run::Node* Level_Run::save_to_memory(std::vector<Entry_t>& vec) {
+// stream the merged sources into blocks of block_entry_cnt entries. Returns
+// the first node of the new chain, or nullptr if nothing was written.
+Level_Run::Node* Level_Run::write_blocks(std::vector<MergeSource>& sources,
+                                         Node*& chain_end,
+                                         bool drop_tombstones) {
   // setting a static number of underlying file blocks.
-  int block_entry_cnt =
+  size_t block_entry_cnt =
       pow(level_ratio, current_level + 1) * buffer_size / max_size + 1;
-  int block_cnt = vec.size() / block_entry_cnt + 1;
-  int vector_partitions_l = 0;
-  int vector_partitions_r = block_entry_cnt;
 
-  // std::cout << "block_entry_cnt: " << block_entry_cnt << std::endl;
-  // std::cout << "vec size " << vec.size() << std::endl;
-  // std::cout << "inserted block cnt: " << block_cnt << std::endl;
-
-  Entry_t entry;
-  std::vector<std::future<Node*>> futures;
-  while (block_cnt > 0) {
-    if (vector_partitions_r > vec.size()) {  // keep everything inbound.
-      vector_partitions_r = vec.size();
+  Node* chain_start = nullptr;
+  chain_end = nullptr;
+  Node* node = nullptr;
+  std::unique_ptr<RunWriter> writer;
+
+  auto finish_block = [&]() {
+    writer->finish();
+    writer.reset();
+    sync_path(node->file_location);
+    node->lower = node->fence_pointers.front();
+    node->upper = node->fence_pointers.back();
+    node->file = std::make_shared<RunFile>(node->file_location, cache);
+    node->is_empty = false;
+
+    if (chain_end) {
+      chain_end->next = node;
+    } else {
+      chain_start = node;
     }
-    futures.push_back(pool.enqueue([&vec, vector_partitions_l,
-                                    vector_partitions_r, this]() -> Node* {
-      Node* temp_nd;
-      temp_nd = process_block(vec, vector_partitions_l, vector_partitions_r);
-
-      return temp_nd;
-    }));
-    // update loop info.
-    vector_partitions_l = vector_partitions_r;
-    vector_partitions_r = vector_partitions_r + block_entry_cnt;
-    block_cnt--;
-  }
-
-  Node* chain_start = futures[0].get();
-  Node* chain_cur = chain_start;
-  for (int i = 1; i < futures.size(); i++) {
-    Node* tmp = futures[i].get();
-    chain_cur->next = tmp;
-    chain_cur = chain_cur->next;
+    chain_end = node;
+  };
+
+  merge_sources(
+      sources,
+      [&](const Entry_t& entry) {
+        if (!writer) {
+          node = new Node;
+          node->file_location = generate_file_name();
+          node->bloom =
+              new BloomFilter(bits_per_entry * block_entry_cnt, bloom_type,
+                              BloomFilter::probes_for(bits_per_entry));
+          writer = std::make_unique<RunWriter>(
+              node->file_location, node->bloom, &node->fence_pointers, limiter,
+              page_format);
+        }
+        writer->add(entry);
+        if (writer->count() == block_entry_cnt) {
+          finish_block();
+        }
+      },
+      drop_tombstones, limiter);
+  if (writer) {
+    finish_block();
   }
 
   return chain_start;
 }
 
-// process the information into file blocks for leveled level. 
-Level_Run::Node* Level_Run::process_block(const std::vector<Entry_t>& vec,
-                                          int l,
-                                          int r) {
-  // set up file output structure.
-  std::vector<int> bool_bits;
-  int memory_cnt = 0;
-  std::string filename = generate_file_name(6);
-  std::ofstream out(filename, std::ios::binary);
-  if (!out.is_open()) {
-    throw std::runtime_error("Unable to open file for writing");
+// build a merge source over the blocks from chain up to (not including)
+// chain_stop. Blocks in a chain are sorted and disjoint.
+MergeSource Level_Run::chain_source(Node* chain, Node* chain_stop) {
+  MergeSource source;
+  for (; chain != chain_stop; chain = chain->next) {
+    source.add_segment(chain->file, chain->fence_pointers);
   }
-  // fence pointer and bloom filter
-  BloomFilter* bloom = new BloomFilter(bits_per_entry * (r - l));
-  std::vector<KEY_t> fence_pointers;
-
-  auto start = vec.begin() + l;
-  auto end =
-      vec.begin() +
-      r;  // if there is a bug here, adding 1 to this is probably the solution.
-
-  for (auto entry = start; entry != end; ++entry) {  // go through all entries.
-
-    bool_bits.push_back(entry->del ? 1 : 0);
-    bloom->set(entry->key);
-
-    if (memory_cnt == 0) {
-      fence_pointers.push_back(entry->key);
-    }
-    out.write(reinterpret_cast<const char*>(&entry->key), sizeof(entry->key));
-    out.write(reinterpret_cast<const char*>(&entry->val), sizeof(entry->val));
-
-    memory_cnt = sizeof(entry->key) + sizeof(entry->val) + memory_cnt;
-
-    // reached page maximum. Append the bool_bits to the back of the page.
-    if (memory_cnt == SAVE_MEMORY_PAGE_SIZE) {
-      memory_cnt = 0;
-      uint64_t result = 0;
-
-      if (bool_bits.size() != 64) {
-        throw std::runtime_error("Vector must contain exactly 64 elements.");
-      }
-
-      for (size_t i = 0; i < 64; ++i) {
-        if (bool_bits[i] != 0 && bool_bits[i] != 1) {
-          for (int value : bool_bits)  // for debugging.
-          {
-            std::cout << value << std::endl;
-          }
-          throw std::runtime_error("Vector must contain only 0s and 1s.");
-        }
-        // Shift the bit to the correct position and set it in 'result'
-        result |= static_cast<uint64_t>(bool_bits[i]) << (63 - i);
-      }
-      out.write(reinterpret_cast<const char*>(&result), sizeof(result));
-      bool_bits.clear();
-    }
-  }
-
-  if (bool_bits.size() > 0) {
-    while (bool_bits.size() < 64) {
-      int padding = 0;
-      bool_bits.push_back(padding);  // pad with zeros
-    }
-
-    uint64_t result = 0;
-    for (size_t i = 0; i < 64; ++i) {
-      if (bool_bits[i] != 0 && bool_bits[i] != 1) {
-        throw std::runtime_error("Vector must contain only 0s and 1s.");
-      }
-      // Shift the bit to the correct position and set it in 'result'
-      result |= static_cast<uint64_t>(bool_bits[i]) << (63 - i);
-    }
-    out.write(reinterpret_cast<const char*>(&result), sizeof(result));
-    bool_bits.clear();
-  }
-  out.close();
-  // construct node* for return
-  Node* node = new Node;
-  node->lower = fence_pointers.front();
-  node->upper = fence_pointers.back();
-  node->file_location = filename;
-  node->bloom = bloom;
-  node->fence_pointers = fence_pointers;
-  node->is_empty = false;
-  node->next = nullptr;
-
-  return node;
+  return source;
 }
 
 // this function randomly selects certain number of continuous blocks so that
 // the remaining level size is 2/3 of the maximum capacity.
-std::unordered_map<KEY_t, Entry> Level_Run::flush() {
+Level_Run::Splice Level_Run::select_flush() {
+  Splice splice;
   std::random_device rd;
   std::mt19937 eng(rd());
   return_size();  // refresh current size.
@@ -331,63 +142,24 @@ std::unordered_map<KEY_t, Entry> Level_Run::flush() {
       current_size - max_size * 2 / 3;  // this division here dictates how much
                                         // of the level is flushed down. Need to
                                         // change in LSM_tree.cpp too
-  std::uniform_int_distribution<> distr(0, max_size * 2 / 3);
-
-  // std::cout << "flushing: " << blocks_to_flush << std::endl;
+  if (blocks_to_flush <= 0) {
+    return splice;
+  }
+  std::uniform_int_distribution<> distr(0, current_size - blocks_to_flush);
   int start_point = distr(eng);
-  int idx = 0;
-  Node* cur = root;
 
-  // watch the off by one.
-  while (idx < start_point - 1) {
+  Node* cur = root;
+  for (int idx = 0; idx < start_point; idx++) {
+    splice.prev = cur;
     cur = cur->next;
-    idx++;
   }
-
-  Node* front = cur;
-  Node* to_delete = cur->next;
-
-  std::vector<std::future<std::unordered_map<KEY_t, Entry>>> futures;
-
-  for (int i = blocks_to_flush; i > 0; i--) {
+  splice.first = cur;
+  for (int i = 0; i < blocks_to_flush; i++) {
     cur = cur->next;
-    futures.push_back(pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry> {
-      std::vector<Entry_t> temp_vec =
-          load_full_file(cur->file_location, cur->fence_pointers);
-      std::unordered_map<KEY_t, Entry> temp;
-      for (auto& entry : temp_vec) {
-        auto it = temp.find(entry.key);
-        if (it == temp.end()) {
-          temp[entry.key] = entry;
-        }
-      }
-
-      return temp;
-    }));
-  }
-
-  if (cur) {
-    front->next = cur->next;
-    cur->next = nullptr;  // i don't lose a block here right?
-  } else {  // if cur is already a nullptr -- reached end of the linked list.
-    front->next = nullptr;
-  }
-
-  std::unordered_map<KEY_t, Entry> ret;
-  for (auto& fut : futures) {
-    std::unordered_map<KEY_t, Entry> results = fut.get();
-
-    ret.merge(results);
-  }
-  // std::cout << ret.size() << " moved leveling" << std::endl;
-  while (to_delete) {
-    Node* tmp = to_delete->next;
-    delete to_delete;
-    to_delete = tmp;
   }
+  splice.stop = cur;
 
-  // futures.clear();
-  return ret;
+  return splice;
 }
 
 std::unique_ptr<Entry_t> Level_Run::get(KEY_t key) {
@@ -399,7 +171,7 @@ std::unique_ptr<Entry_t> Level_Run::get(KEY_t key) {
       if (cur->bloom->is_set(key)) {
         // do disk search
         int starting_point = search_fence(key, cur->fence_pointers);
-        ret = disk_search(key, cur->file_location, starting_point);
+        ret = disk_search(key, cur, starting_point);
         if (ret) {
           return ret;
         }
@@ -414,248 +186,66 @@ std::unique_ptr<Entry_t> Level_Run::get(KEY_t key) {
   return nullptr;
 }
 
-// read certain bytes from the binary file storages.
-std::unique_ptr<Entry_t> Level_Run::disk_search(KEY_t key,
-                                                std::string file_location,
-                                                int starting_point) {
-  auto entry = std::make_unique<Entry_t>();
-  size_t read_size;
-
-  std::ifstream file(file_location, std::ios::binary);
-
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open file for reading");
-  }
-
-  // get file size
-  file.seekg(0, std::ios::end);
-  size_t fileSize = file.tellg();
-
-  // modify read_size base on how much more we can read.
-  if ((starting_point + 1) * LOAD_MEMORY_PAGE_SIZE > fileSize) {
-    read_size = fileSize - starting_point * LOAD_MEMORY_PAGE_SIZE;
-  } else {
-    read_size = LOAD_MEMORY_PAGE_SIZE;
-  }
-
-  // read in del flags: starting * page_size -> begining of page
-  file.seekg(starting_point * LOAD_MEMORY_PAGE_SIZE + read_size - BOOL_BYTE_CNT,
-             std::ios::beg);
-  uint64_t result;
-  file.read(reinterpret_cast<char*>(&result), BOOL_BYTE_CNT);
-  std::bitset<64> del_flag_bitset(result);
-  file.seekg(0, std::ios::beg);  // reset file stream
-
-  // shift file stream pointer to starting_point base on fence pointer result.
-  file.seekg(starting_point * LOAD_MEMORY_PAGE_SIZE, std::ios::beg);
-
-  int idx = 0;
-  while (read_size >
-         BOOL_BYTE_CNT) {  // change into binary search if i have time.
-    file.read(reinterpret_cast<char*>(&entry->key), sizeof(entry->key));
-    file.read(reinterpret_cast<char*>(&entry->val), sizeof(entry->val));
-
-    if (key == entry->key) {
-      entry->del = del_flag_bitset[63 - idx];
-      file.close();
-
-      return entry;
+// look up a sorted batch of keys, walking the blocks and the keys together.
+// Keys that share a page are answered from a single page load. found[i] is
+// set to the entry for keys[i], deleted or not, or left null.
+void Level_Run::multi_get(const std::vector<KEY_t>& keys,
+                          std::vector<std::unique_ptr<Entry_t>>& found) {
+  found.resize(keys.size());
+  Node* cur = root;
+  size_t i = 0;
+  while (cur && i < keys.size()) {
+    if (keys[i] < cur->lower) {  // falls between blocks.
+      i++;
+      continue;
     }
-
-    read_size = read_size - sizeof(entry->key) - sizeof(entry->val);
-    idx++;
-  }
-
-  file.close();
-  return nullptr;  // return null if we couldn't find the result.
-}
-
-int Level_Run::search_fence(KEY_t key, std::vector<KEY_t>& fence_pointers) {
-  int starting_point;
-
-  for (int i = 0; i < fence_pointers.size(); ++i) {
-    // special case for matching at the last fence post
-    if (i == fence_pointers.size() - 1) {
-      if (key == fence_pointers.at(i)) {
-        starting_point = i - 1;
-        return starting_point;
-      } else {
-        return -1;
-      }
+    if (keys[i] > cur->upper) {
+      cur = cur->next;
+      continue;
     }
 
-    if (key >= fence_pointers.at(i) && key < fence_pointers.at(i + 1)) {
-      starting_point = i;
-      return starting_point;
+    int loaded = -1;
+    std::shared_ptr<const CachedPage> cached;
+    for (; i < keys.size() && keys[i] <= cur->upper; i++) {
+      if (!cur->bloom->is_set(keys[i])) {
+        continue;
+      }
+      int starting_point = search_fence(keys[i], cur->fence_pointers);
+      if (starting_point == -1) {
+        continue;
+      }
+      if (starting_point != loaded) {
+        cached = cur->file->load_page(starting_point);
+        loaded = starting_point;
+      }
+      found[i] = page_get(cached->data, cached->size, keys[i]);
     }
-  }
-
-  return -1;  // return -1 if we hit a false positive with bloom filter.
-}
-
-// search a range on disk. 
-std::unordered_map<KEY_t, Entry_t> Level_Run::range_search(KEY_t lower,
-                                                           KEY_t upper) {
-  std::unordered_map<KEY_t, Entry_t> ret;
-  Node* cur = root;
-
-  std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> futures;
-  while (cur) {
-    futures.push_back(pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry_t> {
-      std::unordered_map<KEY_t, Entry_t> tmp =
-          range_block_search(lower, upper, cur);
-
-      return tmp;
-    }));
-
     cur = cur->next;
   }
-  for (auto& fut : futures) {
-    std::unordered_map<KEY_t, Entry_t> results = fut.get();
-
-    ret.merge(results);
-  }
-  futures.clear();
-  return ret;
 }
 
-// function called page search.
-std::unordered_map<KEY_t, Entry_t> Level_Run::range_block_search(KEY_t lower,
-                                                                 KEY_t upper,
-                                                                 Node* cur) {
-  std::unordered_map<KEY_t, Entry_t> ret;
-
-  std::cout << cur->file_location << std::endl;
-  std::ifstream file(cur->file_location, std::ios::binary);
-  size_t read_size;
-  Entry_t entry;
-
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open file for reading");
-  }
-
-  file.seekg(0, std::ios::end);
-  size_t file_size = file.tellg();
-  file.seekg(0, std::ios::beg);
-  // find starting positions on which pages to look at.
-  int starting_left = search_fence(lower, cur->fence_pointers);
-  int starting_right = search_fence(upper, cur->fence_pointers);
-  if (starting_left == -1 && starting_right == -1) {
-    if (lower < cur->fence_pointers.at(0) &&
-        upper > cur->fence_pointers.back()) {
-      starting_left = 0;
-      starting_right = cur->fence_pointers.size() - 1;
-    } else {
-      return ret;
-    }
-  } else if (starting_right == -1) {
-    starting_right = cur->fence_pointers.back();
-  } else if (starting_left == -1) {
-    starting_left = 0;
-  }
-
-  std::vector<char> file_data(file_size);
+// read certain bytes from the binary file storages.
+std::unique_ptr<Entry_t> Level_Run::disk_search(KEY_t key,
+                                                Node* node,
+                                                int starting_point) {
+  auto cached = node->file->load_page(starting_point);
+  return page_get(cached->data, cached->size, key);
+}
 
-  if (!file.read(file_data.data(), file_size)) {
-    std::cerr << "Error reading file.\n";
+int Level_Run::search_fence(KEY_t key, std::vector<KEY_t>& fence_pointers) {
+  // page i holds keys in [fence[i], fence[i + 1]); the last fence is the
+  // largest key of the run and only closes the last page.
+  if (fence_pointers.size() < 2) {
+    return -1;
   }
+  auto last = fence_pointers.end() - 1;
+  auto it = std::upper_bound(fence_pointers.begin(), last, key);
 
-  // read in the run's information.
-  for (int i = starting_left; i < starting_right; i++) {
-    size_t start_index = i * LOAD_MEMORY_PAGE_SIZE;
-    if (start_index >= file_size)
-      break;  // Ensure we do not start beyond the file size
-
-    size_t end_index = (i + 1) * LOAD_MEMORY_PAGE_SIZE;
-    read_size = std::min(end_index, file_size) -
-                start_index;  // Ensures read_size is within bounds
-
-    // read in del flags: starting * page_size -> beginning of page
-    uint64_t result;
-    if (read_size >= BOOL_BYTE_CNT) {
-      std::memcpy(&result, &file_data[start_index + read_size - BOOL_BYTE_CNT],
-                  sizeof(result));
-    } else {
-      result = 0;  // Not enough data to read BOOL_BYTE_CNT bytes
-    }
-    std::bitset<64> del_flag_bitset(result);
-
-    // Need to figure out how to part this in one go.
-
-    int idx = (i - 1) * LOAD_MEMORY_PAGE_SIZE;
-    int cnt = 0;
-    while (idx < read_size - BOOL_BYTE_CNT) {
-      Entry_t entry;
-      std::memcpy(&entry.key, &file_data[idx], sizeof(KEY_t));
-      idx += sizeof(KEY_t);
-      std::memcpy(&entry.val, &file_data[idx], sizeof(VALUE_t));
-      idx += sizeof(KEY_t);
-      entry.del = del_flag_bitset[63 - cnt];
-      cnt++;
-      if (!entry.del && entry.key >= lower && entry.key <= upper) {
-        ret[entry.key] = entry;
-      }
-    }
+  if (it == fence_pointers.begin() || key > *last) {
+    return -1;  // return -1 if we hit a false positive with bloom filter.
   }
 
-  file.close();
-  return ret;
-  // // get file size
-  // file.seekg(0, std::ios::end);
-  // size_t fileSize = file.tellg();
-
-  // // find starting positions.
-  // int starting_left = search_fence(lower, cur->fence_pointers);
-  // int starting_right = search_fence(upper, cur->fence_pointers);
-
-  // if (starting_left == -1 && starting_right == -1) {
-  //   if (lower < cur->fence_pointers.at(0) &&
-  //       upper > cur->fence_pointers.back()) {
-  //     starting_left = 0;
-  //     starting_right = cur->fence_pointers.size() - 1;
-  //   } else {
-  //     return ret;
-  //   }
-  // } else if (starting_right == -1) {
-  //   starting_right = cur->fence_pointers.back();
-  // } else if (starting_left == -1) {
-  //   starting_left = 0;
-  // }
-  // for (int i = starting_left; i <= starting_right; i++) {
-  //   // modify read_size base on how much more we can read.
-  //   if ((i + 1) * LOAD_MEMORY_PAGE_SIZE > fileSize) {
-  //     read_size = fileSize - i * LOAD_MEMORY_PAGE_SIZE;
-  //   } else {
-  //     read_size = LOAD_MEMORY_PAGE_SIZE;
-  //   }
-
-  //   // read in del flags: starting * page_size -> begining of page
-  //   file.seekg(i * LOAD_MEMORY_PAGE_SIZE + read_size - BOOL_BYTE_CNT,
-  //              std::ios::beg);
-  //   uint64_t result;
-  //   file.read(reinterpret_cast<char*>(&result), BOOL_BYTE_CNT);
-  //   std::bitset<64> del_flag_bitset(result);
-  //   file.seekg(0, std::ios::beg);
-
-  //   file.seekg(i * LOAD_MEMORY_PAGE_SIZE, std::ios::beg);
-
-  //   int idx = 0;
-  //   while (read_size >
-  //          BOOL_BYTE_CNT) {  // change into binary search if i have time.
-  //     file.read(reinterpret_cast<char*>(&entry.key), sizeof(entry.key));
-  //     file.read(reinterpret_cast<char*>(&entry.val), sizeof(entry.val));
-
-  //     if (lower <= entry.key && upper >= entry.key) {
-  //       entry.del = del_flag_bitset[63 - idx];
-  //       ret[entry.key] = entry;
-  //     }
-
-  //     read_size = read_size - sizeof(entry.key) - sizeof(entry.val);
-  //     idx++;
-  //   }
-  // }
-  // file.close();
-  // return ret;
+  return (it - fence_pointers.begin()) - 1;
 }
 
 std::string Level_Run::print() {
@@ -670,19 +260,8 @@ std::string Level_Run::print() {
 }
 
 // helper function for generating a file_name for on-disk storage file name.
-std::string Level_Run::generate_file_name(size_t length) {
-  const std::string chars = "abcdefghijklmnopqrstuvwxyz0123456789";
-  std::string randomString;
-  auto seed =
-      std::chrono::high_resolution_clock::now().time_since_epoch().count();
-  std::mt19937 generator(static_cast<unsigned int>(seed));
-  std::uniform_int_distribution<> distribution(0, chars.size() - 1);
-
-  for (size_t i = 0; i < length; ++i) {
-    randomString += chars[distribution(generator)];
-  }
-
-  return "lsm_tree_leveling" + randomString + ".dat";
+std::string Level_Run::generate_file_name() {
+  return file_numbers->file_name("lsm_tree_leveling", ".dat");
 }
 
 int Level_Run::return_size() {
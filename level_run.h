@@ -12,12 +12,21 @@
 #include <vector>
 #include <mutex> 
 
+#include "block_cache.h"
 #include "bloom.h"
+#include "compaction.h"
+#include "file_numbers.h"
 #include "key_value.h"
-#include "lib/ThreadPool.h"
+#include "manifest.h"
+#include "page_codec.h"
+#include "page_search.h"
+#include "rate_limiter.h"
+#include "run_file.h"
 
 class Level_Run {
-  ThreadPool& pool;
+  BlockCache* cache;  // shared page cache owned by the tree.
+  RateLimiter* limiter;  // compaction IO budget owned by the tree.
+  FileNumbers* file_numbers;  // names the block files, owned by the tree.
 
   float bits_per_entry;  // need to change the LSM tree code to store this as a
                          // constant.
@@ -29,17 +38,20 @@ class Level_Run {
   int buffer_size;
 
   float leveling_flush_ratio = 0.9;
+  BloomFilter::Type bloom_type;
+  PageFormat page_format;
 
  public:
 
    struct Node {
-    BloomFilter* bloom;
+    BloomFilter* bloom = nullptr;
     std::vector<KEY_t> fence_pointers;
     std::string file_location;
+    std::shared_ptr<RunFile> file;  // open handle for the block's file
 
     // these are stored as the rough fence posts of this node/
-    KEY_t lower;
-    KEY_t upper;
+    KEY_t lower = 0;
+    KEY_t upper = 0;
 
     Node* next = nullptr;
     bool is_empty = true;
@@ -48,52 +60,79 @@ class Level_Run {
       delete bloom;     // Delete the BloomFilter object if it exists.
       bloom = nullptr;  // Prevent dangling pointer.
 
-      std::filesystem::path fileToDelete(file_location);
-      std::filesystem::remove(fileToDelete);
+      if (!file_location.empty()) {
+        std::filesystem::remove(file_location);
+      }
     }
   };
 
-  Node* root;
+  Node* root = nullptr;  // nullptr while the level is empty.
 
-  Level_Run(ThreadPool& pool,
+  Level_Run(BlockCache* cache,
+            RateLimiter* limiter,
+            FileNumbers* file_numbers,
             int max_size,
             int level,
             int ratio,
             int buffer,
-            int bits_per_entry)
-      : pool(pool),
+            int bits_per_entry,
+            BloomFilter::Type bloom_type = BloomFilter::CLASSIC,
+            PageFormat page_format = PAGE_RAW)
+      : cache(cache),
+        limiter(limiter),
+        file_numbers(file_numbers),
         max_size(max_size),
         current_level(level),
         level_ratio(ratio),
         buffer_size(buffer),
-        bits_per_entry(bits_per_entry) {
-    root = new Node;
-  }
+        bits_per_entry(bits_per_entry),
+        bloom_type(bloom_type),
+        page_format(page_format) {}
   // ~Level_Run();
 
-  // used to insert blocks of data into the existing leveling levels.
-  void insert_block(std::vector<Entry_t>&);
+  // A change to the block list: the blocks from first up to stop are
+  // replaced by the chain of new blocks. Both sides may be empty. Merges
+  // build a Splice without touching the level, so their IO runs while
+  // readers still use the level, and apply_splice() then publishes it.
+  struct Splice {
+    Node* prev = nullptr;   // block before the replaced range, nullptr at root
+    Node* first = nullptr;  // first replaced block, nullptr if none
+    Node* stop = nullptr;   // block right after the replaced range
+    Node* chain_start = nullptr;
+    Node* chain_end = nullptr;
+  };
+
+  // merge the incoming sources with the blocks they overlap into new blocks.
+  // The incoming sources are newer than anything already in this level. Set
+  // drop_tombstones when no deeper level exists.
+  Splice prepare_insert(std::vector<MergeSource>& incoming,
+                        bool drop_tombstones);
+
+  // link the splice into the level. Returns the replaced blocks, unlinked,
+  // for the caller to delete once no reader can reach them.
+  Node* apply_splice(Splice& splice);
 
-  // methods to load level and insert into table.
-  std::vector<Entry_t> load_full_file(
-      std::string,
-      std::vector<KEY_t>&);  // just need the index in the storage.
-  Node* save_to_memory(std::vector<Entry_t>&);
-  Node* process_block(const std::vector<Entry_t>&, int, int);
+  // merge sources into a chain of new blocks; chain_end gets the last node.
+  Node* write_blocks(std::vector<MergeSource>& sources,
+                     Node*& chain_end,
+                     bool drop_tombstones);
+  // one merge source reading the blocks of a chain in order.
+  MergeSource chain_source(Node* chain, Node* chain_stop = nullptr);
 
-  // Find some blocks to push down for merging
-  std::unordered_map<KEY_t, Entry> flush();
+  // Find some blocks to push down for merging. The returned splice removes
+  // them from this level once applied.
+  Splice select_flush();
 
   // searching in this level; TODO: add the two functions.
   std::unique_ptr<Entry_t> get(KEY_t key);
-  std::unordered_map<KEY_t, Entry_t> range_search(KEY_t lower, KEY_t upper);
+  void multi_get(const std::vector<KEY_t>& keys,
+                 std::vector<std::unique_ptr<Entry_t>>& found);
 
-  std::unique_ptr<Entry_t> disk_search(KEY_t, std::string, int);
+  std::unique_ptr<Entry_t> disk_search(KEY_t, Node*, int);
   int search_fence(KEY_t key, std::vector<KEY_t>&);
-  std::unordered_map<KEY_t, Entry_t> range_block_search(KEY_t, KEY_t, Node*);
   // helper functions
   std::string print();
-  std::string generate_file_name(size_t length);
+  std::string generate_file_name();
   int return_size();
   int return_max_size();
 };
@@ -1,18 +1,112 @@
 #include "lsm_tree.h"
 
+#include <getopt.h>
+
+LSM_Options parse_options(int argc, char* argv[]) {
+  static const struct option long_options[] = {
+      {"wal-sync", required_argument, nullptr, 's'},
+      {"group-commit-ms", required_argument, nullptr, 'm'},
+      {"group-commit-entries", required_argument, nullptr, 'e'},
+      {"compaction-threads", required_argument, nullptr, 't'},
+      {"compaction-io-mb", required_argument, nullptr, 'b'},
+      {"packed-page-level", required_argument, nullptr, 'p'},
+      {"blocked-bloom-level", required_argument, nullptr, 'f'},
+      {nullptr, 0, nullptr, 0}};
+
+  LSM_Options options;
+  int opt;
+  optind = 1;
+  while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    std::string arg = optarg ? optarg : "";
+    switch (opt) {
+      case 's':
+        if (arg == "every") {
+          options.wal_sync_mode = WriteAheadLog::EVERY_WRITE;
+        } else if (arg == "group") {
+          options.wal_sync_mode = WriteAheadLog::GROUP;
+        } else if (arg == "none") {
+          options.wal_sync_mode = WriteAheadLog::NONE;
+        } else {
+          throw std::invalid_argument("--wal-sync takes every, group or none");
+        }
+        break;
+      case 'm':
+        options.wal_group_commit_ms = std::stoi(arg);
+        break;
+      case 'e':
+        options.wal_group_commit_entries = std::stoul(arg);
+        break;
+      case 't':
+        options.compaction_threads = std::max(std::stoul(arg), 1UL);
+        break;
+      case 'b':  // MB per second
+        options.compaction_io_bytes_per_sec = std::stoul(arg) << 20;
+        break;
+      case 'p':
+        options.packed_page_level = std::stoi(arg);
+        break;
+      case 'f':
+        options.blocked_bloom_level = std::stoi(arg);
+        break;
+      default:
+        throw std::invalid_argument("Unknown option");
+    }
+  }
+  return options;
+}
+
+// load data on start up. The structure itself is rebuilt by
+// recover_manifest; this only creates the tree with its saved configuration.
+LSM_Tree* meta_load_save(const LSM_Options& options) {
+  std::vector<std::string> records = Manifest::read_records();
+
+  // read in the lsm tree meta data (in the first record)
+  float bits_per_entry;
+  int level_ratio, buffer_size, mode, threads, partition;
+  std::string tag;
+  std::istringstream iss(records.empty() ? "" : records.front());
+  if (!(iss >> tag >> bits_per_entry >> level_ratio >> buffer_size >> mode >>
+        threads >> partition) ||
+      tag != "config") {
+    throw std::runtime_error("Error reading LSM tree instance meta data");
+  }
+
+  return new LSM_Tree(bits_per_entry, level_ratio, buffer_size, mode, threads,
+                      partition, 16384, options);
+}
+
 LSM_Tree::LSM_Tree(float bits_ratio,
                    size_t level_ratio,
                    size_t buffer_size,
                    int mode,
                    size_t threads,
-                   int partition)
-    : bloom_bits_per_entry(bits_ratio),
+                   int partition,
+                   size_t cache_pages,
+                   const LSM_Options& options)
+    : wal_sync_mode(options.wal_sync_mode),
+      wal_group_commit_ms(options.wal_group_commit_ms),
+      wal_group_commit_entries(options.wal_group_commit_entries),
+      compaction_threads(options.compaction_threads),
+      compaction_io_bytes_per_sec(options.compaction_io_bytes_per_sec),
+      bloom_bits_per_entry(bits_ratio),
       level_ratio(level_ratio),
       buffer_size(buffer_size),
       mode(mode),
       pool(threads),
-      leveling_partitions(partition) {
-  in_mem = new BufferLevel(buffer_size);
+      block_cache(cache_pages),
+      leveling_partitions(partition),
+      blocked_bloom_level(options.blocked_bloom_level),
+      packed_page_level(options.packed_page_level) {
+  // run files from an earlier process keep their names.
+  file_numbers.skip_existing("lsm_tree_", ".dat");
+  file_numbers.skip_existing("lsm_tree_leveling", ".dat");
+  in_mem = std::make_shared<BufferLevel>(buffer_size);
+  compaction_limiter = std::make_unique<RateLimiter>(compaction_io_bytes_per_sec);
+  compactor = std::make_unique<CompactionScheduler>(compaction_threads);
+  string_tree = std::make_unique<StringTree>(
+      bits_ratio, level_ratio, buffer_size * PAGE_ENTRY_SIZE, &pool,
+      compaction_limiter.get(), wal_sync_mode, wal_group_commit_ms, wal_group_commit_entries);
+
   root = new Level_Node{0, level_ratio};
   if (mode == 1) {
     level_root = new Leveling_Node;
@@ -22,14 +116,24 @@ LSM_Tree::LSM_Tree(float bits_ratio,
     float cur_FPR = bloom_bits_per_entry * pow(level_ratio, lazy_cut_off);
     float bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
     level_root->leveled_run =
-        new Level_Run(pool, leveling_partitions, lazy_cut_off, level_ratio,
-                      buffer_size, bloom_bits);
+        new Level_Run(&block_cache, compaction_limiter.get(), &file_numbers,
+                      leveling_partitions, lazy_cut_off, level_ratio,
+                      buffer_size, bloom_bits, bloom_type(lazy_cut_off),
+                      page_format(lazy_cut_off));
   }
   num_of_threads = threads;
+
+  flush_thread = std::thread(&LSM_Tree::flush_loop, this);
 }
 
 LSM_Tree::~LSM_Tree() {
-  delete in_mem;
+  {
+    std::lock_guard<std::mutex> lock(mem_mutex);
+    stop_flush = true;
+  }
+  flush_cv.notify_all();
+  flush_thread.join();
+  compactor.reset();  // finishes queued compactions and joins the workers.
 
   Level_Node* temp;
   while (root) {
@@ -53,19 +157,7 @@ LSM_Tree::~LSM_Tree() {
  * @param  {VALUE_t} val :
  */
 void LSM_Tree::put(KEY_t key, VALUE_t val) {
-  int insert_result;
-  std::vector<Entry_t> buffer;
-  Level_Node* cur = root;
-
-  insert_result = in_mem->insert(key, val);
-
-  if (insert_result == -1) {
-    merge_policy();
-
-    // clear buffer and insert again.
-    in_mem->clear_buffer();
-    in_mem->insert(key, val);
-  }
+  put(Entry_t{key, val, false});
 
   // total++;
   // if (total % 100000 == 0) {
@@ -73,64 +165,233 @@ void LSM_Tree::put(KEY_t key, VALUE_t val) {
   // }
 }
 
-// overload for loading memory on boot.
+// shared write path for puts and deletes (del flag set). Returns once the
+// entry's log record is durable, as the sync mode asks.
 void LSM_Tree::put(Entry_t entry) {
-  int insert_result;
-  std::vector<Entry_t> buffer;
-  Level_Node* cur = root;
+  uint64_t lsn = insert(entry);
+  if (wal) {
+    wal->commit(lsn);
+  }
+}
 
-  insert_result = in_mem->insert(entry);
+// insert an entry into the buffer and queue its log record; returns the
+// record's number. Log replay uses it directly and syncs once at the end.
+uint64_t LSM_Tree::insert(const Entry_t& entry) {
+  std::unique_lock<std::mutex> lock(mem_mutex);
+  int insert_result = in_mem->insert(entry);
+
+  if (insert_result == -1) {
+    // hand the full buffer to the flush thread and insert into a fresh one.
+    seal_buffer(lock);
+    in_mem->insert(entry);
+  }
+
+  // logged after the insert so the record lands in the segment of the
+  // buffer that holds it.
+  return wal ? wal->append(&entry, 1) : 0;
 }
 
 /**
- * LSM_Tree get
- * search for key value pair and return value if exists.
- * @param  {KEY_t} key                 :
- * @return {std::unique_ptr<Entry_t>}  :
+ * LSM_Tree write
+ * apply a batch of puts and deletes. The batch is inserted into the buffer
+ * under one lock and logged as one record, and the buffer is sealed at most
+ * once for it, so readers and log replay see all of it or none. A batch with
+ * more distinct keys than a whole buffer holds would have to be split over
+ * several buffers and is rejected with std::length_error, unapplied.
+ * @param  {WriteBatch} batch :
  */
-std::unique_ptr<Entry_t> LSM_Tree::get(KEY_t key) {
-  /* Search the buffer for a value. */
-  // use threadpool to look for results in smaller blocks of the buffer.
-  std::vector<std::future<std::unique_ptr<Entry_t>>> mem_futures;
+void LSM_Tree::write(const WriteBatch& batch) {
+  const std::vector<Entry_t>& entries = batch.get_entries();
+  if (entries.empty()) {
+    return;
+  }
 
-  int mem_cnt = 0;
-  int search_size = 10000;
-  int buffer_size = in_mem->size();
-  typename std::vector<Entry_t>::reverse_iterator back = in_mem->store.rbegin();
+  uint64_t lsn = 0;
+  {
+    std::unique_lock<std::mutex> lock(mem_mutex);
+    if (in_mem->insert_batch(entries) == -1) {
+      seal_buffer(lock);
+      if (in_mem->insert_batch(entries) == -1) {
+        throw std::length_error("Batch of " + std::to_string(entries.size()) +
+                                " writes does not fit in the buffer");
+      }
+    }
 
-  while (buffer_size > 0) {
-    if (buffer_size < search_size) {
-      search_size = buffer_size;
+    // logged after the insert so the record lands in the segment of the
+    // buffer that holds the batch.
+    if (wal) {
+      lsn = wal->append(entries.data(), entries.size());
     }
-    mem_futures.push_back(pool.enqueue([=]() -> std::unique_ptr<Entry> {
-      return in_mem->get(key, back, search_size);
-    }));
+  }
+  if (wal) {
+    wal->commit(lsn);
+  }
+}
 
-    // sync up after each batch of threads finish task to prevent unecessary
-    // future searches.
-    if ((mem_cnt + 1) % num_of_threads == 0) {
-      for (auto& fut : mem_futures) {
-        auto result = fut.get();
-        if (result) {
-          return result;
+/**
+ * LSM_Tree bulk_load
+ * Loads a binary file of (key, val) pairs without going through the buffer.
+ * The file is read in chunks of bulk_load_chunk_entries; each chunk is sorted
+ * on the pool and spilled to a temporary file, then the chunks are merged
+ * into one run whose bloom filter and fence pointers are built as it is
+ * written. When a key appears more than once the last pair wins, as with
+ * puts. An empty tree takes the run at the level sized for it; otherwise it
+ * becomes the newest run of level 0 so it hides the older data.
+ * @param  {std::string} file_path :
+ */
+void LSM_Tree::bulk_load(const std::string& file_path) {
+  std::ifstream file(file_path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Cannot open file: " + file_path);
+  }
+  std::lock_guard<std::mutex> load_lock(bulk_load_mutex);
+
+  // the load is newer than everything written before it, so the buffers
+  // go to disk first.
+  {
+    std::unique_lock<std::mutex> lock(mem_mutex);
+    if (in_mem->size() > 0) {
+      seal_buffer(lock);
+    }
+  }
+  wait_for_flush();
+
+  struct Chunk {
+    std::string file_name;
+    std::vector<KEY_t> fence_pointers;
+    size_t cnt = 0;
+  };
+  std::deque<Chunk> chunks;  // in file order; references stay valid
+  std::deque<std::future<void>> futures;
+
+  const size_t pair_size = sizeof(KEY_t) + sizeof(VALUE_t);
+  std::vector<char> raw(bulk_load_chunk_entries * pair_size);
+  while (file) {
+    file.read(raw.data(), raw.size());
+    size_t cnt = file.gcount() / pair_size;
+    if (cnt == 0) {
+      break;
+    }
+
+    auto entries = std::make_shared<std::vector<Entry_t>>(cnt);
+    for (size_t i = 0; i < cnt; i++) {
+      Entry_t& entry = (*entries)[i];
+      std::memcpy(&entry.key, &raw[i * pair_size], sizeof(KEY_t));
+      std::memcpy(&entry.val, &raw[i * pair_size + sizeof(KEY_t)],
+                  sizeof(VALUE_t));
+      entry.del = false;
+    }
+
+    chunks.emplace_back();
+    Chunk& chunk = chunks.back();
+    chunk.file_name =
+        "lsm_tree_bulk_" + std::to_string(chunks.size()) + ".sort";
+
+    // bound memory to one chunk per pool thread.
+    if (futures.size() >= num_of_threads) {
+      futures.front().get();
+      futures.pop_front();
+    }
+    futures.push_back(pool.enqueue([&chunk, entries]() {
+      // stable, so the last pair of a key stays last among its duplicates.
+      std::stable_sort(entries->begin(), entries->end());
+      RunWriter writer(chunk.file_name, nullptr, &chunk.fence_pointers);
+      for (size_t i = 0; i < entries->size(); i++) {
+        if (i + 1 < entries->size() &&
+            (*entries)[i + 1].key == (*entries)[i].key) {
+          continue;
         }
+        writer.add((*entries)[i]);
+      }
+      writer.finish();
+      chunk.cnt = writer.count();
+    }));
+  }
+  for (auto& fut : futures) {
+    fut.get();
+  }
+  file.close();
+
+  if (chunks.empty()) {
+    return;
+  }
+
+  // later chunks hold the newer pairs, so they come first.
+  std::vector<MergeSource> sources;
+  size_t total_cnt = 0;
+  for (auto rit = chunks.rbegin(); rit != chunks.rend(); ++rit) {
+    sources.emplace_back(std::make_shared<RunFile>(rit->file_name),
+                         rit->fence_pointers);
+    total_cnt += rit->cnt;
+  }
+
+  // a run at level i holds about buffer_size * level_ratio^i entries. The
+  // leveling levels only change through compactions, so in mode 1 the run
+  // stops at the last tiered level and is merged down from there.
+  int level = 0;
+  {
+    std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
+    if (is_bottom(root)) {
+      for (double run_size = buffer_size; run_size < total_cnt;
+           run_size *= level_ratio) {
+        level++;
+      }
+      if (mode == 1) {
+        level = std::min(level, lazy_cut_off - 1);
       }
-      mem_futures.clear();
     }
+  }
+
+  Run run = create_run(sources, level);
 
-    buffer_size -= search_size;
-    back += search_size;
-    mem_cnt++;
+  {
+    VersionEdit edit;
+    std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+    Level_Node* target = root;
+    // something was flushed meanwhile and is newer than the load.
+    if (!is_bottom(root)) {
+      level = 0;
+    }
+    for (int i = 0; i < level; i++) {
+      if (!target->next_level) {
+        target->next_level =
+            new Level_Node(target->level + 1, target->max_num_of_runs);
+        total_levels++;
+        edit.add_level(target->level + 1);
+      }
+      target = target->next_level;
+    }
+    run.set_current_level(level);
+    publish_run(target, run, edit);
+    log_edit(edit);
+    schedule_compactions();
   }
 
-  // check futures for any remaining queued results.
-  for (auto& fut : mem_futures) {
-    auto result = fut.get();
-    if (result) {
-      return result;
+  for (auto& chunk : chunks) {
+    std::filesystem::remove(chunk.file_name);
+  }
+}
+
+/**
+ * LSM_Tree get
+ * search for key value pair and return value if exists.
+ * @param  {KEY_t} key                 :
+ * @return {std::unique_ptr<Entry_t>}  :
+ */
+std::unique_ptr<Entry_t> LSM_Tree::get(KEY_t key) {
+  /* Search the buffer for a value. */
+  // the buffer is sorted and holds one entry per key, so a deleted key found
+  // here is returned as is and hides anything older on disk.
+  // sealed buffers that are still being flushed are searched newest first.
+  for (auto& mem : memory_snapshot()) {
+    std::unique_ptr<Entry_t> mem_entry = mem->get(key);
+    if (mem_entry) {
+      return mem_entry;
     }
   }
 
+  std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
+
   /**********************************************
    *  searching for value on tiered level on disk
    * ********************************************/
@@ -142,30 +403,26 @@ std::unique_ptr<Entry_t> LSM_Tree::get(KEY_t key) {
     int cnt = 0;
     for (auto rit = cur->run_storage.rbegin(); rit != cur->run_storage.rend();
          ++rit) {
-      futures.push_back(pool.enqueue(
-          [=]() -> std::unique_ptr<Entry> { return process_run(rit, key); }));
+      futures.push_back(
+          pool.enqueue([this, rit, key]() -> std::unique_ptr<Entry> {
+            return process_run(rit, key);
+          }));
 
       // sync up after each batch of threads finish task to prevent unecessary
       // future searches.
       if ((cnt + 1) % num_of_threads == 0) {
-        for (auto& fut : futures) {
-          auto result = fut.get();
-          if (result) {
-            return result;
-          }
+        auto result = first_result(futures);
+        if (result) {
+          return result;
         }
-        futures.clear();
       }
       cnt++;
     }
     // check futures for any remaining queued results.
-    for (auto& fut : futures) {
-      auto result = fut.get();
-      if (result) {
-        return result;
-      }
+    auto result = first_result(futures);
+    if (result) {
+      return result;
     }
-    futures.clear();
     cur = cur->next_level;
   }
 
@@ -186,6 +443,21 @@ std::unique_ptr<Entry_t> LSM_Tree::get(KEY_t key) {
   return nullptr;
 }
 
+// wait for every search in the batch, so none is still reading a run once
+// the tree lock is released, and return the hit from the newest run.
+std::unique_ptr<Entry_t> LSM_Tree::first_result(
+    std::vector<std::future<std::unique_ptr<Entry_t>>>& futures) {
+  std::unique_ptr<Entry_t> found;
+  for (auto& fut : futures) {
+    auto result = fut.get();
+    if (!found && result) {
+      found = std::move(result);
+    }
+  }
+  futures.clear();
+  return found;
+}
+
 std::unique_ptr<Entry_t> LSM_Tree::process_run(
     typename std::vector<Run>::reverse_iterator rit,
     const KEY_t& key) {
@@ -194,11 +466,9 @@ std::unique_ptr<Entry_t> LSM_Tree::process_run(
   if (rit->search_bloom(key)) {
     int starting_point = rit->search_fence(key);
     if (starting_point != -1) {
-      entry = rit->disk_search(starting_point, SAVE_MEMORY_PAGE_SIZE, key);
+      entry = rit->disk_search(starting_point, key);
+      // a deleted entry is returned too: it hides older versions below.
       if (entry) {
-        if (entry->del) {
-          return nullptr;
-        }
         return entry;
       }
     }
@@ -208,721 +478,708 @@ std::unique_ptr<Entry_t> LSM_Tree::process_run(
 }
 
 /**
- * LSM_Tree
- *  do range from top to bottom, and back to front. Keep a linked list of the
- * results for later traverse. After searching in each run, create a vector of
- * all values within range. When consolidating the ranges, keep a hashmap, and
- * go from top to bottom.
- * @param  {KEY_t} lower           :
- * @param  {KEY_t} upper           :
- * @return {std::vector<Entry_t>}  :
+ * LSM_Tree multi_get
+ * Looks up a batch of keys at once. The keys are sorted and deduplicated, and
+ * every level is searched for all keys still unresolved: each run probes its
+ * bloom filter for the whole batch and loads a page once for all of the keys
+ * it holds. The runs of a tiered level are searched in parallel on the pool.
+ * @param  {std::vector<KEY_t>} keys                :
+ * @return {std::vector<std::unique_ptr<Entry_t>>}  : one result per key, in
+ * the order given; null when the key is absent. Deleted entries are returned
+ * with del set, as in get.
  */
-std::vector<Entry_t> LSM_Tree::range(KEY_t lower, KEY_t upper) {
-  // for storing All of the available sub-buffers created.
-  std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> futures;
-  std::vector<Entry_t> buffer;
-
-  /* ---------------------------------
-  *****Multi-thread search buffer*******
-  ----------------------------------- */
-  std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> mem_futures;
-
-  int mem_cnt = 0;
-  int search_size = 10000;
-  int buffer_size = in_mem->size();
-  typename std::vector<Entry_t>::reverse_iterator back = in_mem->store.rbegin();
-
-  while (buffer_size > 0) {
-    if (buffer_size < search_size) {
-      search_size = buffer_size;
+std::vector<std::unique_ptr<Entry_t>> LSM_Tree::multi_get(
+    const std::vector<KEY_t>& keys) {
+  std::vector<KEY_t> sorted_keys(keys);
+  std::sort(sorted_keys.begin(), sorted_keys.end());
+  sorted_keys.erase(std::unique(sorted_keys.begin(), sorted_keys.end()),
+                    sorted_keys.end());
+  std::vector<std::unique_ptr<Entry_t>> found(sorted_keys.size());
+
+  // keys not resolved yet and their positions in sorted_keys; both sorted.
+  std::vector<KEY_t> pending;
+  std::vector<size_t> pending_idx;
+  auto resolve = [&](std::vector<std::unique_ptr<Entry_t>>& results) {
+    size_t kept = 0;
+    for (size_t j = 0; j < pending.size(); j++) {
+      if (results[j]) {
+        found[pending_idx[j]] = std::move(results[j]);
+      } else {
+        pending[kept] = pending[j];
+        pending_idx[kept] = pending_idx[j];
+        kept++;
+      }
     }
-    mem_futures.push_back(
-        pool.enqueue([back, search_size, upper, lower,
-                      this]() -> std::unordered_map<KEY_t, Entry_t> {
-          std::unordered_map<KEY_t, Entry_t> tmp;
-          size_t remaining = search_size;
-          typename std::vector<Entry_t>::reverse_iterator rit = back;
-          while (remaining > 0) {
-            Entry_t entry = *rit;
-
-            if (entry.key <= upper && entry.key >= lower) {
-              if (tmp.find(entry.key) == tmp.end()) {
-                tmp[entry.key] = entry;
-              }
-            }
-            rit++;
-            remaining--;
-          }
-          return tmp;
-        }));
-
-    buffer_size -= search_size;
-    back += search_size;
-    mem_cnt++;
-  }
-
-  std::unordered_map<KEY_t, Entry_t> hash_mp;
-  // update content within the buffer
-  for (auto& fut : mem_futures) {
-    auto result = fut.get();
-    if (result.size() > 0) {
-      hash_mp.merge(result);
+    pending.resize(kept);
+    pending_idx.resize(kept);
+  };
+
+  for (size_t i = 0; i < sorted_keys.size(); i++) {
+    pending.push_back(sorted_keys[i]);
+    pending_idx.push_back(i);
+  }
+
+  /* Search the buffers, newest first. */
+  for (auto& mem : memory_snapshot()) {
+    std::vector<std::unique_ptr<Entry_t>> results(pending.size());
+    for (size_t j = 0; j < pending.size(); j++) {
+      results[j] = mem->get(pending[j]);
     }
+    resolve(results);
   }
 
-  /* ---------------------------------
-  ************Search disk**************
-  ----------------------------------- */
-  std::vector<Entry_t> ret;
+  std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
 
-  Level_Node* cur = root;
-  while (cur) {
-    // iterate each level from back to front.
+  /* tiered levels: every run of a level is searched at once. */
+  for (Level_Node* cur = root; cur && !pending.empty(); cur = cur->next_level) {
+    std::vector<std::future<std::vector<std::unique_ptr<Entry_t>>>> futures;
+    // the latest run comes first and wins when several runs hold a key.
     for (auto rit = cur->run_storage.rbegin(); rit != cur->run_storage.rend();
          ++rit) {
-      // ret_cur = ret_cur->next;
-      futures.push_back(
-          pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry_t> {
-            std::vector<Entry_t> temp_vec =
-                rit->range_disk_search(lower, upper);
-            std::unordered_map<KEY_t, Entry_t> temp_mp;
-            for (auto& entry : temp_vec) {
-              auto it = temp_mp.find(entry.key);
-              if (it == temp_mp.end()) {
-                temp_mp[entry.key] = entry;
-              }
-            }
-            return temp_mp;
-          }));
+      futures.push_back(pool.enqueue([&pending, rit]() {
+        std::vector<std::unique_ptr<Entry_t>> results;
+        rit->multi_get(pending, results);
+        return results;
+      }));
     }
-    cur = cur->next_level;
-  }
 
-  for (auto& fut : futures) {
-    std::unordered_map<KEY_t, Entry_t> results = fut.get();
-    // the merge method disgards repeating key from the merged map.
-    hash_mp.merge(results);
+    std::vector<std::unique_ptr<Entry_t>> results(pending.size());
+    for (auto& fut : futures) {
+      std::vector<std::unique_ptr<Entry_t>> run_results = fut.get();
+      for (size_t j = 0; j < results.size(); j++) {
+        if (!results[j] && run_results[j]) {
+          results[j] = std::move(run_results[j]);
+        }
+      }
+    }
+    resolve(results);
   }
-  futures.clear();
 
-  /* -----------------------------------------------------------------
-  ********Search leveled levels disk in optimized mode **************
-  ------------------------------------------------------------------ */
-  // Going into the leveling levels iff there is a leveling level.
-  if (level_root) {
-    std::cout << "going into leveling levels" << std::endl;
-    Leveling_Node* level_cur = level_root;
-    while (level_cur) {
-      std::cout << "searching " << level_cur->level << std::endl;
-      std::unordered_map<KEY_t, Entry_t> tmp =
-          level_cur->leveled_run->range_search(lower, upper);
-      hash_mp.merge(tmp);
-      level_cur = level_cur->next_level;
+  /* leveled levels */
+  if (mode == 1) {
+    for (Leveling_Node* level_cur = level_root; level_cur && !pending.empty();
+         level_cur = level_cur->next_level) {
+      std::vector<std::unique_ptr<Entry_t>> results;
+      level_cur->leveled_run->multi_get(pending, results);
+      resolve(results);
     }
   }
-
-  for (const auto& pair : hash_mp) {
-    ret.push_back(pair.second);
+  tree_lock.unlock();
+
+  std::vector<std::unique_ptr<Entry_t>> ret(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    size_t idx = std::lower_bound(sorted_keys.begin(), sorted_keys.end(),
+                                  keys[i]) -
+                 sorted_keys.begin();
+    if (found[idx]) {
+      ret[i] = std::make_unique<Entry_t>(*found[idx]);
+    }
   }
-
   return ret;
 }
 
 /**
- * LSM_Tree del
- *  This function deletes a key in the LSM Tree.
+ * LSM_Tree range
+ * Scans the tree with an Iterator from lower, so entries come back sorted and
+ * the scan stops at upper or after limit entries.
+ * @param  {KEY_t} lower           :
+ * @param  {KEY_t} upper           :
+ * @param  {size_t} limit          : maximum number of entries, 0 for all.
+ * @return {std::vector<Entry_t>}  :
  */
-void LSM_Tree::del(KEY_t key) {
-  int del_result;
-  std::vector<Entry_t> buffer;
-  Level_Node* cur = root;
-
-  del_result = in_mem->del(key);
+std::vector<Entry_t> LSM_Tree::range(KEY_t lower, KEY_t upper, size_t limit) {
+  std::vector<Entry_t> ret;
+  std::unique_ptr<Iterator> it = new_iterator(upper);
 
-  if (del_result == -1)  // buffer is full.
-  {
-    merge_policy();
-    // clear buffer and del again.
-    in_mem->clear_buffer();
-    in_mem->del(key);
+  for (it->Seek(lower); it->Valid(); it->Next()) {
+    ret.push_back(it->entry());
+    if (limit > 0 && ret.size() >= limit) {
+      break;
+    }
   }
+  return ret;
 }
 
-/**
- * LSM_Tree
- * This function manages how to use the two available merge policies depending
- * on operating mode.:
- */
-void LSM_Tree::merge_policy() {
-  // std::vector<Entry_t> buffer = in_mem->flush_buffer();
-
-  std::vector<std::future<EntryList>> futures;
-  auto parts = splitVector(in_mem->store, num_of_threads);
-  for (int i = 0; i < num_of_threads; i++) {
-    // Launch a thread to handle each part of the vector
-    futures.push_back(pool.enqueue([i, parts, this]() -> EntryList {
-      EntryList tmp = mergeSort(parts[i]);
-      return tmp;
-    }));
-  }
+std::unique_ptr<LSM_Tree::Iterator> LSM_Tree::new_iterator(KEY_t upper_bound) {
+  return std::make_unique<Iterator>(*this, upper_bound);
+}
 
-  // Combine sorted parts
-  EntryList buffer;
-  for (auto& future : futures) {
-    EntryList partSorted = future.get();
-    buffer = merge_s(buffer, partSorted);  // Implement merging of two sorted
+LSM_Tree::Iterator::Iterator(LSM_Tree& tree, KEY_t upper_bound)
+    : upper_bound(upper_bound) {
+  // buffers first, newest first; they are small and copied whole.
+  for (auto& mem : tree.memory_snapshot()) {
+    mem_entries.push_back(mem->get_range(MIN_KEY, upper_bound));
+  }
+  std::vector<MergeSource> sources;
+  for (auto& entries : mem_entries) {
+    sources.emplace_back(entries);
   }
-  futures.clear();
-  std::unordered_map<KEY_t, Entry_t> merge_map;
-  // put in_mem content into the buffer.
-  for (auto& entry : buffer) {
-    merge_map[entry.key] = entry;
-  }
-
-  /************************************************************
-   *                Unoptimized mode
-   *************************************************************/
-  if (mode == 0) {
-    Level_Node* cur = root;
-    std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> futures;
-    std::set<size_t> level_to_delete;
-
-    while (cur && cur->run_storage.size() == cur->max_num_of_runs - 1) {
-      // naive full tiering merge policy.
-      for (auto rit = cur->run_storage.rbegin(); rit != cur->run_storage.rend();
-           ++rit) {
-        futures.push_back(
-            pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry_t> {
-              std::vector<Entry_t> temp_vec =
-                  load_full_file(rit->get_file_location(), rit->return_fence());
-              std::unordered_map<KEY_t, Entry_t> temp_mp;
-              for (auto& entry : temp_vec) {
-                auto it = temp_mp.find(entry.key);
-                if (it == temp_mp.end()) {
-                  temp_mp[entry.key] = entry;
-                }
-              }
-              return temp_mp;
-            }));
-      }
-      // flag current level for delete.
-      if (!cur->next_level) {  // add a tiered level if we don't have a
-                               // following level.
-        cur->next_level = new Level_Node(cur->level + 1, cur->max_num_of_runs);
-        total_levels++;
-      }
-
-      level_to_delete.emplace(cur->level);
-      cur = cur->next_level;
-    }
-
-    for (auto& fut : futures) {
-      std::unordered_map<KEY_t, Entry_t> results = fut.get();
-      // the merge method disgards repeating key from the merged map.
-      merge_map.merge(results);
-    }
-
-    // convert hash_mp back to vector form.
-
-    std::vector<Entry_t> merge_buffer;
-    merge_buffer.reserve(merge_map.size());
 
-    for (const auto& pair : merge_map) {
-      merge_buffer.push_back(pair.second);
-    }
-    std::sort(merge_buffer.begin(), merge_buffer.end());
-    std::cout << merge_buffer.size() << " moved" << std::endl;
-    // push into the new level.
-    Run merged_run = create_run(merge_buffer, cur->level);
-    cur->run_storage.push_back(merged_run);
-
-    // remove merged level's in-memory representation and disk files.
-    Level_Node* del_cur = root;
-    std::vector<std::future<void>> delete_futures;
-    while (level_to_delete.size() > 0) {
-      if (level_to_delete.find(del_cur->level) != level_to_delete.end()) {
-        for (int i = 0; i < del_cur->run_storage.size(); i++) {
-          std::filesystem::path fileToDelete(
-              del_cur->run_storage[i].get_file_location());
-          std::filesystem::remove(fileToDelete);
-        }
-        del_cur->run_storage.clear();
-        level_to_delete.erase(del_cur->level);
-      }
-      del_cur = del_cur->next_level;
-    }
+  // then every level top to bottom, the newest run of a level first.
+  std::shared_lock<std::shared_mutex> tree_lock(tree.tree_mutex);
+  for (Level_Node* cur = tree.root; cur; cur = cur->next_level) {
+    tree.collect_tiered_sources(cur, sources);
+  }
+  for (Leveling_Node* level_cur = tree.level_root; level_cur;
+       level_cur = level_cur->next_level) {
+    sources.push_back(
+        level_cur->leveled_run->chain_source(level_cur->leveled_run->root));
+  }
 
-  } else if (mode == 1) {
-    /************************************************************
-     *                Optimized mode
-     *************************************************************/
-    Level_Node* cur = root;
-    Leveling_Node* level_cur = level_root;
-    // this is counter for whether we want to use leveling levels.
-    int max_level = 0;
-
-    std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> futures;
-    std::set<size_t> level_to_delete;
-
-    while (cur && cur->run_storage.size() == cur->max_num_of_runs - 1) {
-      // naive full tiering merge policy.
-      for (auto rit = cur->run_storage.rbegin(); rit != cur->run_storage.rend();
-           ++rit) {
-        futures.push_back(
-            pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry_t> {
-              std::vector<Entry_t> temp_vec =
-                  load_full_file(rit->get_file_location(), rit->return_fence());
-              std::unordered_map<KEY_t, Entry_t> temp_mp;
-              for (auto& entry : temp_vec) {
-                auto it = temp_mp.find(entry.key);
-                if (it == temp_mp.end()) {
-                  temp_mp[entry.key] = entry;
-                }
-              }
-              return temp_mp;
-            }));
-      }
+  merged = std::make_unique<MergingIterator>(std::move(sources), upper_bound);
+  skip_deleted();
+}
 
-      if (!cur->next_level && cur->level != lazy_cut_off - 1) {
-        cur->next_level = new Level_Node(cur->level + 1, cur->max_num_of_runs);
-        total_levels++;
-      }
+void LSM_Tree::Iterator::skip_deleted() {
+  while (Valid() && merged->entry().del) {
+    merged->next();
+  }
+}
 
-      level_to_delete.emplace(cur->level);
-      cur = cur->next_level;
-      max_level++;
-    }
+void LSM_Tree::Iterator::SeekToFirst() {
+  Seek(MIN_KEY);
+}
 
-    for (auto& fut : futures) {
-      std::unordered_map<KEY_t, Entry_t> results = fut.get();
-      // the merge method disgards repeating key from the merged map.
-      merge_map.merge(results);
-    }
+void LSM_Tree::Iterator::Seek(KEY_t key) {
+  merged->seek(key);
+  skip_deleted();
+}
 
-    // convert hash_mp back to vector form.
-    std::vector<Entry_t> merge_buffer;
-    merge_buffer.reserve(merge_map.size());
+bool LSM_Tree::Iterator::Valid() const {
+  return merged->valid() && merged->entry().key <= upper_bound;
+}
 
-    for (const auto& pair : merge_map) {
-      merge_buffer.push_back(pair.second);
-    }
+void LSM_Tree::Iterator::Next() {
+  merged->next();
+  skip_deleted();
+}
 
-    merge_map.clear();  // reset the merge map to be reused later.
-    // remove merged level's in-memory representation and disk files.
-    Level_Node* del_cur = root;
-    std::vector<std::future<void>> delete_futures;
-    while (level_to_delete.size() > 0) {
-      if (level_to_delete.find(del_cur->level) != level_to_delete.end()) {
-        for (int i = 0; i < del_cur->run_storage.size(); i++) {
-          std::filesystem::path fileToDelete(
-              del_cur->run_storage[i].get_file_location());
-          std::filesystem::remove(fileToDelete);
-        }
-        del_cur->run_storage.clear();
-        level_to_delete.erase(del_cur->level);
-      }
-      del_cur = del_cur->next_level;
-    }
+const Entry_t& LSM_Tree::Iterator::entry() const {
+  return merged->entry();
+}
 
-    /************************************************************
-     *               Handling of the leveling levels
-     *************************************************************/
-    // cur is always nullptr here.
-    if (max_level == lazy_cut_off) {
-      while (level_cur &&
-             level_cur->leveled_run->return_size() >
-                 level_cur->leveled_run->return_max_size() * 2 / 3) {
-        // create new level if next level doesn't exist.
-        if (!level_cur->next_level) {
-          level_cur->next_level = new Leveling_Node;
-          level_cur->next_level->level = level_cur->level + 1;
-
-          float cur_FPR =
-              bloom_bits_per_entry * pow(level_ratio, level_cur->level + 1);
-          float bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
-
-          // change here to make dynamic level ratio after the leveling levels.
-          level_cur->next_level->leveled_run = new Level_Run(
-              pool, leveling_partitions * level_cur->level,
-              level_cur->level + 1, level_ratio, buffer_size, bloom_bits);
-        }
+/**
+ * LSM_Tree del
+ *  This function deletes a key in the LSM Tree.
+ */
+void LSM_Tree::del(KEY_t key) {
+  // deletion is a write with the del flag set.
+  put(Entry_t{key, 0, true});
+}
 
-        std::unordered_map<KEY_t, Entry_t> tmp = partial_merge(level_cur);
-        merge_map.merge(tmp);
+/**
+ * LSM_Tree seal_buffer
+ * Moves the full active buffer onto the immutable queue and replaces it with
+ * an empty one. Writers only wait here when max_immutable_buffers sealed
+ * buffers are already queued for flushing. Caller must hold mem_mutex.
+ */
+void LSM_Tree::seal_buffer(std::unique_lock<std::mutex>& lock) {
+  flush_done_cv.wait(
+      lock, [this]() { return imm_mem.size() < max_immutable_buffers; });
+
+  imm_mem.push_back(in_mem);
+  in_mem = std::make_shared<BufferLevel>(buffer_size);
+  if (wal) {
+    imm_wal_segments.push_back(wal->rotate());
+  }
+  flush_cv.notify_one();
+}
 
-        level_cur = level_cur->next_level;
+/**
+ * LSM_Tree flush_loop
+ * Body of the background flush thread. Sealed buffers are written to level 0
+ * in the order they were sealed, and only dropped from imm_mem after the new
+ * run is published so gets never miss their data.
+ */
+void LSM_Tree::flush_loop() {
+  while (true) {
+    std::shared_ptr<BufferLevel> sealed;
+    {
+      std::unique_lock<std::mutex> lock(mem_mutex);
+      flush_cv.wait(lock, [this]() { return stop_flush || !imm_mem.empty(); });
+      if (imm_mem.empty()) {
+        return;  // only stop once every sealed buffer is on disk.
       }
+      sealed = imm_mem.front();
     }
 
-    // convert hash_mp back to vector form.
-    for (const auto& pair : merge_map) {
-      merge_buffer.push_back(pair.second);
+    try {
+      flush_buffer(sealed->flush_buffer());
+    } catch (const std::exception& e) {
+      // nobody is waiting on this thread, so report it here rather than
+      // letting the exception terminate the process.
+      std::cerr << "Buffer flush failed: " << e.what() << std::endl;
     }
-    std::sort(merge_buffer.begin(), merge_buffer.end());
 
-    // std::cout << merge_buffer.size() << " moved" << std::endl;
-    //  push the merged vector into different levels depend on whether the
-    //  leveling level is needed.
-    if (max_level == lazy_cut_off) {
-      level_cur->leveled_run->insert_block(merge_buffer);
-
-    } else {
-      Run merged_run = create_run(merge_buffer, cur->level);
-      cur->run_storage.push_back(merged_run);
+    {
+      std::lock_guard<std::mutex> lock(mem_mutex);
+      imm_mem.pop_front();
+      // the buffer is on disk now, so its log segment is no longer needed.
+      if (!imm_wal_segments.empty()) {
+        WriteAheadLog::remove_segment(imm_wal_segments.front());
+        imm_wal_segments.pop_front();
+      }
     }
-
-  } else {
-    std::cout << "Wrong mode" << std::endl;
+    flush_done_cv.notify_all();
   }
 }
+
 /**
- * LSM_Tree merge - used for tiered levels.
- *  The function will collect the information in a level and bring it into
- * memory for flushing down to the next tiered level.
- * @param  {LSM_Tree::Level_Node*} cur :
- * @return {std::vector<Entry_t>}      :
+ * LSM_Tree recover_wal
+ * Starts write-ahead logging. Segments left behind by an earlier process are
+ * replayed through the normal write path, oldest first, and removed once
+ * their entries are logged again in the new segments.
  */
-std::unordered_map<KEY_t, Entry_t> LSM_Tree::merge(LSM_Tree::Level_Node*& cur) {
-  // for storing All of the available sub-buffers created.
-  std::vector<std::future<std::unordered_map<KEY_t, Entry_t>>> futures;
-  std::set<size_t> level_to_delete;
-
-  // naive full tiering merge policy.
-  for (auto rit = cur->run_storage.rbegin(); rit != cur->run_storage.rend();
-       ++rit) {
-    futures.push_back(pool.enqueue([=]() -> std::unordered_map<KEY_t, Entry_t> {
-      std::vector<Entry_t> temp_vec =
-          load_full_file(rit->get_file_location(), rit->return_fence());
-      std::unordered_map<KEY_t, Entry_t> temp_mp;
-      for (auto& entry : temp_vec) {
-        auto it = temp_mp.find(entry.key);
-        if (it == temp_mp.end()) {
-          temp_mp[entry.key] = entry;
-        }
-      }
-      return temp_mp;
-    }));
-  }
+void LSM_Tree::recover_wal() {
+  std::vector<uint64_t> segments = WriteAheadLog::existing_segments();
+  uint64_t next_seq = segments.empty() ? 1 : segments.back() + 1;
 
-  // reconstruct a full buffer and resolve updates/ deletes
-  std::unordered_map<KEY_t, Entry_t> hash_mp;
+  wal = std::make_unique<WriteAheadLog>(wal_sync_mode, wal_group_commit_ms,
+                                        wal_group_commit_entries);
+  wal->open(next_seq);
 
-  for (auto& fut : futures) {
-    std::unordered_map<KEY_t, Entry_t> results = fut.get();
-    // the merge method disgards repeating key from the merged map.
-    hash_mp.merge(results);
+  for (uint64_t seq : segments) {
+    for (auto& entry : WriteAheadLog::read_segment(seq)) {
+      insert(entry);
+    }
   }
+  wal->sync();
 
-  futures.clear();
+  for (uint64_t seq : segments) {
+    WriteAheadLog::remove_segment(seq);
+  }
+}
 
-  return hash_mp;
+// block until every sealed buffer has been flushed to disk.
+void LSM_Tree::wait_for_flush() {
+  std::unique_lock<std::mutex> lock(mem_mutex);
+  flush_done_cv.wait(lock, [this]() { return imm_mem.empty(); });
 }
 
-// implement a lazy merge approach for the optimized tree
-std::unordered_map<KEY_t, Entry_t> LSM_Tree::partial_merge(
-    LSM_Tree::Leveling_Node*& cur) {
-  std::unordered_map<KEY_t, Entry_t> ret = cur->leveled_run->flush();
+// returns the active buffer followed by the sealed buffers, newest first.
+std::vector<std::shared_ptr<BufferLevel>> LSM_Tree::memory_snapshot() {
+  std::lock_guard<std::mutex> lock(mem_mutex);
+  std::vector<std::shared_ptr<BufferLevel>> ret;
+  ret.reserve(imm_mem.size() + 1);
 
+  ret.push_back(in_mem);
+  for (auto rit = imm_mem.rbegin(); rit != imm_mem.rend(); ++rit) {
+    ret.push_back(*rit);
+  }
   return ret;
 }
 
-// this function will save the in-memory data and maintain file structure for
-// data persistence.
-void LSM_Tree::exit_save() {
-  // save in memory component to file
-  //  write data structure to file.
-  //  memory get its own designated file. named LSM_memory.dat. Don't need meta
-  //  data. secondary memory is maintained by saving another meta data file for
-  //  the file structure.
-  exit_save_memory();
-  level_meta_save();
-}
-
-// create a Run and associated file for a given vector of entries.
-Run LSM_Tree::create_run(std::vector<Entry_t> buffer, int current_level) {
-  std::string file_name = generateRandomString(6);
-  float bloom_bits;
-  float cur_FPR;
-  /*Base on MONKEY, total_bits = -entries*ln(FPR)/(ln(2)^2)*/
+/**
+ * LSM_Tree flush_buffer
+ * Writes a sealed buffer as the newest run of level 0. Merging runs down the
+ * tree is left to the compaction scheduler; the flush only waits for it when
+ * level 0 has twice its run limit, which bounds how far compactions can
+ * fall behind.
+ */
+void LSM_Tree::flush_buffer(EntryList buffer) {
+  // the buffer is already sorted and deduplicated.
+  std::vector<MergeSource> sources;
+  sources.emplace_back(buffer);
 
-  cur_FPR = bloom_bits_per_entry * pow(level_ratio, current_level);
-  bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
-  if (bloom_bits <= 5) {
-    bloom_bits = 5;
+  bool bottom;
+  {
+    std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
+    level0_cv.wait(tree_lock, [this]() {
+      return root->run_storage.size() < 2 * root->max_num_of_runs;
+    });
+    bottom = is_bottom(root);
   }
-  BloomFilter* bloom = new BloomFilter(bloom_bits * buffer.size());
-  std::vector<KEY_t>* fence = new std::vector<KEY_t>;
 
-  LSM_Tree::create_bloom_filter(bloom, buffer);
-  LSM_Tree::save_to_memory(file_name, fence, buffer);
+  Run run = create_run(sources, 0, bottom);
 
-  Run run(file_name, bloom, fence);
-  run.set_current_level(current_level);
-  return run;
+  VersionEdit edit;
+  std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+  publish_run(root, run, edit);
+  log_edit(edit);
+  schedule_compactions();
 }
 
-void LSM_Tree::create_bloom_filter(BloomFilter* bloom,
-                                   const std::vector<Entry_t>& vec) {
-  for (int i = 0; i < vec.size(); i++) {
-    bloom->set(vec[i].key);
-  }
-};
-
 /**
- * save_to_memory
- * The function stores an vector containing entries into a binary and modify the
- * fence pointers for the page.
- *
- * Special attention: The deletion status of each key/value pairs are packed
- * into the first few bits of the page. Current, each page is 512 bytes and can
- * hold 64 key/val pairs. To allow for the deletion feature. I am adding anthoer
- * 64 bits(8 bytes of data) into the end of a memory page, making each actual
- * memory page to be 520 bytes.
- * @param  {std::string} filename              : The file_location for the
- * stored binary file.
- * @param  {std::vector<KEY_t>*} fence_pointer : Pointer to a vector containing
- * the fence pointers
- * @param  {std::vector<Entry_t>} vec          : a vector containing entries.
+ * LSM_Tree schedule_compactions
+ * Queues a compaction for every tiered level that has reached its run limit
+ * and is not being compacted already. Upper levels get the higher priority
+ * since flushes stall behind level 0. Caller holds tree_mutex exclusively.
  */
-void LSM_Tree::save_to_memory(std::string filename,
-                              std::vector<KEY_t>* fence_pointer,
-                              std::vector<Entry_t>& vec) {
-  // two pointers to keep track of memory and fence_pointer traversal.
-  std::vector<int> bool_bits;
-  int memory_cnt = 0, fence_pointer_index = 0;
-  std::ofstream out(filename, std::ios::binary);
-
-  if (!out.is_open()) {
-    throw std::runtime_error("Unable to open file for writing");
-  }
-
-  for (const auto& entry : vec) {  // go through all entries.
-    if (entry.del) {
-      bool_bits.push_back(1);
-    } else {
-      bool_bits.push_back(0);
+void LSM_Tree::schedule_compactions() {
+  for (Level_Node* cur = root; cur; cur = cur->next_level) {
+    if (!cur->compacting && cur->run_storage.size() >= cur->max_num_of_runs) {
+      cur->compacting = true;
+      compactor->schedule(cur->level, [this, cur]() { compact_level(cur); });
     }
+  }
+}
 
-    if (memory_cnt == 0) {
-      fence_pointer->push_back(entry.key);
-      fence_pointer_index++;
+/**
+ * LSM_Tree compact_level
+ * Runs the compaction out of a tiered level. A failed compaction leaves the
+ * level as it was; it is logged, and after a pause the level is scheduled
+ * again, so a flush waiting for room in level 0 is not stuck for good.
+ */
+void LSM_Tree::compact_level(Level_Node* cur) {
+  try {
+    merge_level(cur);
+  } catch (const std::exception& e) {
+    std::cerr << "Compaction of level " << cur->level
+              << " failed: " << e.what() << std::endl;
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(COMPACTION_RETRY_MS));
+    {
+      std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+      cur->compacting = false;
+      schedule_compactions();
     }
-    out.write(reinterpret_cast<const char*>(&entry.key), sizeof(entry.key));
-    out.write(reinterpret_cast<const char*>(&entry.val), sizeof(entry.val));
+    level0_cv.notify_all();
+  }
+}
 
-    memory_cnt = sizeof(entry.key) + sizeof(entry.val) + memory_cnt;
+/**
+ * LSM_Tree merge_level
+ * Merges every run of a full tiered level into one run in the next level,
+ * or into the leveling levels when the tiered levels end here. Runs added to
+ * the level while the merge is running are left in place for the next
+ * compaction.
+ */
+void LSM_Tree::merge_level(Level_Node* cur) {
+  std::vector<MergeSource> sources;
+  size_t merged_cnt;
+  bool bottom;
+  {
+    std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
+    merged_cnt = cur->run_storage.size();
+    collect_tiered_sources(cur, sources);
+    bottom = is_bottom(cur->next_level);
+  }
 
-    // reached page maximum. Append the bool_bits to the back of the page.
-    if (memory_cnt == SAVE_MEMORY_PAGE_SIZE) {
-      memory_cnt = 0;
-      uint64_t result = 0;
+  if (mode == 1 && cur->level == static_cast<size_t>(lazy_cut_off - 1)) {
+    compact_into_leveling(cur, sources, merged_cnt);
+    return;
+  }
 
-      if (bool_bits.size() != 64) {
-        throw std::runtime_error("Vector must contain exactly 64 elements.");
-      }
+  Run run = create_run(sources, cur->level + 1, bottom,
+                       compaction_limiter.get());
 
-      for (size_t i = 0; i < 64; ++i) {
-        if (bool_bits[i] != 0 && bool_bits[i] != 1) {
-          for (int value : bool_bits)  // for debugging.
-          {
-            std::cout << value << std::endl;
-          }
-          throw std::runtime_error("Vector must contain only 0s and 1s.");
-        }
-        // Shift the bit to the correct position and set it in 'result'
-        result |= static_cast<uint64_t>(bool_bits[i]) << (63 - i);
-      }
-      out.write(reinterpret_cast<const char*>(&result), sizeof(result));
-      bool_bits.clear();
+  std::vector<std::string> obsolete;
+  VersionEdit edit;
+  {
+    std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+    if (!cur->next_level) {  // add a tiered level if we don't have a
+                             // following level.
+      cur->next_level = new Level_Node(cur->level + 1, cur->max_num_of_runs);
+      total_levels++;
+      edit.add_level(cur->level + 1);
     }
+    publish_run(cur->next_level, run, edit);
+    obsolete = retire_runs(cur, merged_cnt, edit);
+    log_edit(edit);
+    schedule_compactions();
   }
+  level0_cv.notify_all();
 
-  fence_pointer->push_back(vec.back().key);
+  // remove merged level's disk files.
+  for (auto& file : obsolete) {
+    std::filesystem::remove(file);
+  }
+}
 
-  if (bool_bits.size() > 0) {
-    while (bool_bits.size() < 64) {
-      int padding = 0;
-      bool_bits.push_back(padding);  // pad with zeros
-    }
+// merge the runs of the last tiered level into the top leveling level.
+void LSM_Tree::compact_into_leveling(Level_Node* cur,
+                                     std::vector<MergeSource>& sources,
+                                     size_t merged_cnt) {
+  push_down_leveling();
 
-    uint64_t result = 0;
-    for (size_t i = 0; i < 64; ++i) {
-      if (bool_bits[i] != 0 && bool_bits[i] != 1) {
-        throw std::runtime_error("Vector must contain only 0s and 1s.");
-      }
-      // Shift the bit to the correct position and set it in 'result'
-      result |= static_cast<uint64_t>(bool_bits[i]) << (63 - i);
-    }
-    out.write(reinterpret_cast<const char*>(&result), sizeof(result));
-    bool_bits.clear();
+  // only this job changes the leveling levels, so they can be read unlocked.
+  Level_Run* top = level_root->leveled_run;
+  Level_Run::Splice splice =
+      top->prepare_insert(sources, level_root->next_level == nullptr);
+
+  Level_Run::Node* replaced;
+  std::vector<std::string> obsolete;
+  VersionEdit edit;
+  {
+    std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+    splice_edit(level_root->level, splice, edit);
+    replaced = top->apply_splice(splice);
+    obsolete = retire_runs(cur, merged_cnt, edit);
+    log_edit(edit);
+    schedule_compactions();
   }
+  level0_cv.notify_all();
 
-  out.close();
+  while (replaced) {
+    Level_Run::Node* tmp = replaced->next;
+    delete replaced;
+    replaced = tmp;
+  }
+  for (auto& file : obsolete) {
+    std::filesystem::remove(file);
+  }
 }
 
-/**
- * LSM_Tree exit_save_memory():
- * this function saves the data from the buffer into a binary file when exiting.
- */
-void LSM_Tree::exit_save_memory() {
-  std::vector<int> bool_bits;
-  int memory_cnt = 0;
-  std::string filename = "lsm_tree_memory.dat";
-  std::vector<Entry_t> buffer = in_mem->flush_buffer();
-
-  std::ofstream out(filename, std::ios::binary);
-
-  if (!out.is_open()) {
-    throw std::runtime_error("Unable to open file for writing on exit save");
+// true when nothing older than a new run in target exists: target holds no
+// runs, has no level below it, and the leveling levels are empty. A null
+// target is a level that has not been created yet.
+bool LSM_Tree::is_bottom(Level_Node* target) {
+  if (target && (!target->run_storage.empty() || target->next_level)) {
+    return false;
   }
+  for (Leveling_Node* level_cur = level_root; level_cur;
+       level_cur = level_cur->next_level) {
+    if (level_cur->leveled_run->root) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  for (const auto& entry : buffer) {  // go through all entries.
-    bool_bits.push_back(entry.del);
+// add a finished run as the newest run of target and record it in edit.
+// Caller holds tree_mutex.
+void LSM_Tree::publish_run(Level_Node* target, Run& run, VersionEdit& edit) {
+  if (run.return_fence().empty()) {
+    // every entry was a dropped tombstone.
+    std::filesystem::remove(run.get_file_location());
+    return;
+  }
+  target->run_storage.push_back(run);
+  edit.add_run(target->level, run.get_file_location());
+}
 
-    out.write(reinterpret_cast<const char*>(&entry.key), sizeof(entry.key));
-    out.write(reinterpret_cast<const char*>(&entry.val), sizeof(entry.val));
+// drop the cnt oldest runs of a level after they were merged down, record
+// them in edit, and return their files for deletion once the edit is logged.
+// Caller holds tree_mutex.
+std::vector<std::string> LSM_Tree::retire_runs(Level_Node* cur,
+                                               size_t cnt,
+                                               VersionEdit& edit) {
+  std::vector<std::string> files;
+  for (size_t i = 0; i < cnt; i++) {
+    files.push_back(cur->run_storage[i].get_file_location());
+    edit.remove_run(cur->level, files.back());
+  }
+  cur->run_storage.erase(cur->run_storage.begin(),
+                         cur->run_storage.begin() + cnt);
+  cur->compacting = false;
+  return files;
+}
 
-    memory_cnt = sizeof(entry.key) + sizeof(entry.val) + memory_cnt;
+// record a leveling splice in edit: the replaced blocks are removed and the
+// new chain is added. Call it before the splice is applied.
+void LSM_Tree::splice_edit(int level,
+                           const Level_Run::Splice& splice,
+                           VersionEdit& edit) {
+  for (Level_Run::Node* node = splice.first; node && node != splice.stop;
+       node = node->next) {
+    edit.remove_block(level, node->file_location);
+  }
+  for (Level_Run::Node* node = splice.chain_start; node; node = node->next) {
+    edit.add_block(level, node->file_location);
+    if (node == splice.chain_end) {
+      break;
+    }
+  }
+}
 
-    if (memory_cnt == SAVE_MEMORY_PAGE_SIZE) {
-      memory_cnt = 0;
-      uint64_t result = 0;
+// durably record a change to the structure. Caller holds tree_mutex
+// exclusively, so records are logged in the order changes are published.
+void LSM_Tree::log_edit(const VersionEdit& edit) {
+  if (manifest && !edit.empty()) {
+    manifest->append(edit.encode());
+  }
+}
 
-      if (bool_bits.size() != 64) {
-        throw std::runtime_error("Vector must contain exactly 64 elements.");
-      }
+// add a merge source for every run of a tiered level, newest run first.
+void LSM_Tree::collect_tiered_sources(Level_Node* cur,
+                                      std::vector<MergeSource>& sources) {
+  for (auto rit = cur->run_storage.rbegin(); rit != cur->run_storage.rend();
+       ++rit) {
+    sources.emplace_back(rit->return_file(), rit->return_fence());
+  }
+}
 
-      for (size_t i = 0; i < 64; ++i) {
-        if (bool_bits[i] != 0 && bool_bits[i] != 1) {
-          throw std::runtime_error("Vector must contain only 0s and 1s.");
-        }
-        // Shift the bit to the correct position and set it in 'result'
-        result |= static_cast<uint64_t>(bool_bits[i]) << (63 - i);
-      }
-      out.write(reinterpret_cast<const char*>(&result), sizeof(result));
-      bool_bits.clear();
+/**
+ * LSM_Tree push_down_leveling
+ * Makes room in the leveling levels before new data is inserted at the top.
+ * Every level above 2/3 of its capacity pushes some of its blocks into the
+ * level below. This runs from the deepest full level up, so data only ever
+ * moves one level down and always lands above older versions of its keys.
+ * Each step writes its blocks first and then swaps them in under the lock.
+ */
+void LSM_Tree::push_down_leveling() {
+  std::vector<Leveling_Node*> full_levels;
+  Leveling_Node* level_cur = level_root;
+  while (level_cur && level_cur->leveled_run->return_size() >
+                          level_cur->leveled_run->return_max_size() * 2 / 3) {
+    // create new level if next level doesn't exist.
+    if (!level_cur->next_level) {
+      std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+      add_leveling_level(level_cur);
+      VersionEdit edit;
+      edit.add_level(level_cur->level + 1);
+      log_edit(edit);
     }
+    full_levels.push_back(level_cur);
+    level_cur = level_cur->next_level;
   }
 
-  if (bool_bits.size() > 0) {
-    while (bool_bits.size() < 64) {
-      int padding = 0;
-      bool_bits.push_back(padding);  // pad with zeros
+  for (auto rit = full_levels.rbegin(); rit != full_levels.rend(); ++rit) {
+    Level_Run* upper = (*rit)->leveled_run;
+    Leveling_Node* target = (*rit)->next_level;
+
+    Level_Run::Splice flushed = upper->select_flush();
+    std::vector<MergeSource> sources;
+    sources.push_back(upper->chain_source(flushed.first, flushed.stop));
+    Level_Run::Splice merged = target->leveled_run->prepare_insert(
+        sources, target->next_level == nullptr);
+
+    // publish both sides together so readers see the blocks exactly once.
+    Level_Run::Node *replaced, *pushed_down;
+    VersionEdit edit;
+    {
+      std::unique_lock<std::shared_mutex> tree_lock(tree_mutex);
+      splice_edit(target->level, merged, edit);
+      splice_edit((*rit)->level, flushed, edit);
+      replaced = target->leveled_run->apply_splice(merged);
+      pushed_down = upper->apply_splice(flushed);
+      log_edit(edit);
     }
-    uint64_t result = 0;
-    for (size_t i = 0; i < 64; ++i) {
-      if (bool_bits[i] != 0 && bool_bits[i] != 1) {
-        throw std::runtime_error("Vector must contain only 0s and 1s.");
+
+    // the merged blocks are no longer reachable; drop them and their files.
+    for (Level_Run::Node* chain : {replaced, pushed_down}) {
+      while (chain) {
+        Level_Run::Node* tmp = chain->next;
+        delete chain;
+        chain = tmp;
       }
-      // Shift the bit to the correct position and set it in 'result'
-      result |= static_cast<uint64_t>(bool_bits[i]) << (63 - i);
     }
-    out.write(reinterpret_cast<const char*>(&result), sizeof(result));
-    bool_bits.clear();
   }
-
-  out.close();
 }
 
-// this function saves the meta data/organization of the tree.
-void LSM_Tree::level_meta_save() {
-  // storing each of the secondary storage related data in different files.
-  // bloom and fence pointer binary size are stored as txt in the meta data
-  // file. easier to load data on boot.
-  std::string meta_data = "lsm_tree_level_meta.txt";
-  std::ofstream meta(meta_data);
+// append an empty leveling level below level_cur and return it.
+LSM_Tree::Leveling_Node* LSM_Tree::add_leveling_level(
+    Leveling_Node* level_cur) {
+  level_cur->next_level = new Leveling_Node;
+  level_cur->next_level->level = level_cur->level + 1;
 
-  if (!meta.is_open()) {
-    std::cerr << "Failed to open the files." << std::endl;
-  }
-
-  Level_Node* cur = root;
-  // write meta data to the LSM tree first.
-  meta << bloom_bits_per_entry << " " << level_ratio << " " << buffer_size
-       << " " << mode << " " << num_of_threads << " " << leveling_partitions
-       << "\n";
+  float cur_FPR = bloom_bits_per_entry * pow(level_ratio, level_cur->level + 1);
+  float bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
 
-  while (cur) {
-    // for each level: write current level, level limit, run count, then
-    // specific data for each run.
-    meta << cur->level << " " << cur->max_num_of_runs << " "
-         << cur->run_storage.size() << "\n";
+  // change here to make dynamic level ratio after the leveling levels.
+  level_cur->next_level->leveled_run = new Level_Run(
+      &block_cache, compaction_limiter.get(), &file_numbers,
+      leveling_partitions * level_cur->level, level_cur->level + 1,
+      level_ratio, buffer_size, bloom_bits, bloom_type(level_cur->level + 1),
+      page_format(level_cur->level + 1));
 
-    // for each run: write filename, bloom size and fence size.
-    for (int i = 0; i < cur->run_storage.size(); i++) {
-      BloomFilter temp_bloom = cur->run_storage[i].return_bloom();
-      boost::dynamic_bitset<> temp_bitarray = temp_bloom.return_bitarray();
-
-      std::string bloom_filename =
-          "bloom_" + cur->run_storage[i].get_file_location();
-      std::ofstream bloom(bloom_filename);
-      bloom << temp_bitarray;  // Write the bitset to the file
-      bloom.close();
-
-      // Write fence pointers to binary file
-      std::vector<KEY_t> temp_fence = cur->run_storage[i].return_fence();
-
-      std::string fence_filename =
-          "fence_" + cur->run_storage[i].get_file_location();
-      std::ofstream fence(fence_filename);
-      fence.write(reinterpret_cast<const char*>(&temp_fence[0]),
-                  temp_fence.size() * sizeof(KEY_t));
-      fence.close();
-
-      meta << cur->run_storage[i].get_file_location() << std::endl;
-    }
+  return level_cur->next_level;
+}
 
-    cur = cur->next_level;
+// this function will save the in-memory data and maintain file structure for
+// data persistence.
+void LSM_Tree::exit_save() {
+  // the buffer is already in the write-ahead log and is replayed on boot.
+  // the manifest already holds every structure change; compacting it to a
+  // snapshot keeps the next startup short.
+  wait_for_flush();
+  compactor->wait_idle();
+  if (wal) {
+    wal->sync();
   }
-  if (mode == 1) {
-    Leveling_Node* level_cur = level_root;
-    while (level_cur) {
-      meta << level_cur->level << "\n";
-      Level_Run::Node* in_level_cur = level_cur->leveled_run->root;
+  manifest_snapshot();
+  string_tree->exit_save();
+}
 
-      while (in_level_cur && !in_level_cur->is_empty) {
-        BloomFilter* temp_bloom = in_level_cur->bloom;
-        boost::dynamic_bitset<> temp_bitarray = temp_bloom->return_bitarray();
+// merge the sources into a new Run and its file.
+Run LSM_Tree::create_run(std::vector<MergeSource>& sources,
+                         int current_level,
+                         bool drop_tombstones,
+                         RateLimiter* limiter) {
+  std::string file_name = generate_file_name();
+  float bloom_bits;
+  float cur_FPR;
+  /*Base on MONKEY, total_bits = -entries*ln(FPR)/(ln(2)^2)*/
 
-        std::string bloom_filename = "bloom_" + in_level_cur->file_location;
-        std::ofstream bloom(bloom_filename);
-        bloom << temp_bitarray;  // Write the bitset to the file
-        bloom.close();
+  cur_FPR = bloom_bits_per_entry * pow(level_ratio, current_level);
+  bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
+  if (bloom_bits <= 5) {
+    bloom_bits = 5;
+  }
+  // the output size is only known after the merge, so the filter is sized
+  // for every input entry.
+  BloomFilter* bloom = new BloomFilter(
+      bloom_bits * sources_size_estimate(sources), bloom_type(current_level),
+      BloomFilter::probes_for(bloom_bits));
+  std::vector<KEY_t>* fence = new std::vector<KEY_t>;
 
-        // Write fence pointers to binary file
-        std::vector<KEY_t> temp_fence = in_level_cur->fence_pointers;
+  RunWriter writer(file_name, bloom, fence, limiter,
+                   page_format(current_level));
+  merge_sources(
+      sources, [&writer](const Entry_t& entry) { writer.add(entry); },
+      drop_tombstones, limiter);
+  writer.finish();
+  if (!fence->empty()) {
+    sync_path(file_name);
+  }
 
-        std::string fence_filename = "fence_" + in_level_cur->file_location;
-        std::ofstream fence(fence_filename);
+  Run run(file_name, bloom, fence, &block_cache);
+  run.set_current_level(current_level);
+  return run;
+}
 
-        fence.write((char*)&temp_fence[0], temp_fence.size() * sizeof(KEY_t));
-        fence.close();
+// levels from blocked_bloom_level down use the cache-line-blocked filter.
+BloomFilter::Type LSM_Tree::bloom_type(int level) {
+  if (blocked_bloom_level >= 0 && level >= blocked_bloom_level) {
+    return BloomFilter::BLOCKED;
+  }
+  return BloomFilter::CLASSIC;
+}
 
-        meta << in_level_cur->file_location << std::endl;
+// levels from packed_page_level down store their pages packed.
+PageFormat LSM_Tree::page_format(int level) {
+  if (packed_page_level >= 0 && level >= packed_page_level) {
+    return PAGE_PACKED;
+  }
+  return PAGE_RAW;
+}
 
-        in_level_cur = in_level_cur->next;
-      }
-      level_cur = level_cur->next_level;
+// replace the manifest with a snapshot of the current structure: the tree's
+// configuration, then every level with its runs and blocks in order.
+void LSM_Tree::manifest_snapshot() {
+  if (!manifest) {
+    return;
+  }
+  std::ostringstream config;
+  config << "config " << bloom_bits_per_entry << " " << level_ratio << " "
+         << buffer_size << " " << mode << " " << num_of_threads << " "
+         << leveling_partitions << " " << sizeof(KEY_t) << " "
+         << sizeof(VALUE_t) << "\n";
+
+  // the shared lock keeps edits from being logged until the new file is in
+  // place.
+  std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
+  VersionEdit edit;
+  for (Level_Node* cur = root; cur; cur = cur->next_level) {
+    edit.add_level(cur->level);
+    for (auto& run : cur->run_storage) {
+      edit.add_run(cur->level, run.get_file_location());
     }
   }
-
-  meta.close();
+  for (Leveling_Node* level_cur = level_root; level_cur;
+       level_cur = level_cur->next_level) {
+    edit.add_level(level_cur->level);
+    for (Level_Run::Node* node = level_cur->leveled_run->root; node;
+         node = node->next) {
+      edit.add_block(level_cur->level, node->file_location);
+    }
+  }
+  manifest->rewrite({config.str(), edit.encode()});
 }
 
 // helper function for generating a file_name for on-disk storage file name.
-std::string LSM_Tree::generateRandomString(size_t length) {
-  const std::string chars = "abcdefghijklmnopqrstuvwxyz0123456789";
-  std::string randomString;
-  auto seed =
-      std::chrono::high_resolution_clock::now().time_since_epoch().count();
-  std::mt19937 generator(static_cast<unsigned int>(seed));
-  std::uniform_int_distribution<> distribution(0, chars.size() - 1);
-
-  for (size_t i = 0; i < length; ++i) {
-    randomString += chars[distribution(generator)];
-  }
-
-  return "lsm_tree_" + randomString + ".dat";
+std::string LSM_Tree::generate_file_name() {
+  return file_numbers.file_name("lsm_tree_", ".dat");
 }
 
 void LSM_Tree::print_statistics() {
@@ -942,6 +1199,8 @@ void LSM_Tree::print_statistics() {
   // GET operation
   std::cout << "GET time: " << get_accumulated_time.count() * 1000 << "ms"
             << std::endl;
+  std::cout << "Block cache hits: " << block_cache.hit_count()
+            << " misses: " << block_cache.miss_count() << std::endl;
   // std::cout << "GET disk time: " << get_disk_accumulated_time.count() * 1000
   //           << "ms" << std::endl;
   // std::cout << "GET FP hit: " << FP_hits << std::endl;
@@ -950,246 +1209,193 @@ void LSM_Tree::print_statistics() {
   // delete is essentially the same as get.
 }
 
-// this function reads in the binary file storing data last in buffer.
-void LSM_Tree::load_memory() {
-  std::string memory_data = "lsm_tree_memory.dat";
-  std::ifstream memory(memory_data, std::ios::binary);
-  if (!memory.is_open()) {
-    std::cerr << "Failed to open the memory file." << std::endl;
-  }
-  Entry_t entry;
-
-  // get file size
-  memory.seekg(0, std::ios::end);
-  size_t fileSize = memory.tellg();
-  int total_page = fileSize / LOAD_MEMORY_PAGE_SIZE + 1;
-  int cur_page = 0;
-  int read_size;
-  // modify read_size base on how much more we can read.
-  while (cur_page < total_page) {
-    if ((cur_page + 1) * LOAD_MEMORY_PAGE_SIZE > fileSize) {
-      read_size = fileSize - cur_page * LOAD_MEMORY_PAGE_SIZE;
-    } else {
-      read_size = LOAD_MEMORY_PAGE_SIZE;
-    }
-
-    // read in del flags: starting * page_size -> begining of page
-    memory.seekg(cur_page * LOAD_MEMORY_PAGE_SIZE + read_size - BOOL_BYTE_CNT,
-                 std::ios::beg);
-    uint64_t result;
-    memory.read(reinterpret_cast<char*>(&result), BOOL_BYTE_CNT);
-    std::bitset<64> del_flag_bitset(result);
-    memory.seekg(0, std::ios::beg);  // reset file stream
-
-    // shift file stream pointer to starting_point base on fence pointer result.
-    memory.seekg(cur_page * LOAD_MEMORY_PAGE_SIZE, std::ios::beg);
-
-    int idx = 0;
-    while (read_size >
-           BOOL_BYTE_CNT) {  // change into binary search if i have time.
-      memory.read(reinterpret_cast<char*>(&entry.key), sizeof(entry.key));
-      memory.read(reinterpret_cast<char*>(&entry.val), sizeof(entry.val));
-
-      entry.del = del_flag_bitset[63 - idx];
-      put(entry);
-      read_size = read_size - sizeof(entry.key) - sizeof(entry.val);
-      idx++;
-    }
-    cur_page++;
+/**
+ * LSM_Tree recover_manifest
+ * Rebuilds the on-disk structure from the manifest left by an earlier
+ * process, deletes the files it does not refer to, and starts a new manifest
+ * holding a snapshot of the structure. The string tables are recovered
+ * along with it. Call it before recover_wal, since replaying the log may
+ * flush.
+ */
+void LSM_Tree::recover_manifest() {
+  if (Manifest::exists()) {
+    reconstruct_file_structure(Manifest::read_records());
+    remove_orphan_files();
   }
-
-  memory.close();
+  manifest = std::make_unique<Manifest>();
+  manifest_snapshot();
+  string_tree->recover();
 }
 
-// this function reconstructs the lsm structure from the saved txt file.
-void LSM_Tree::reconstruct_file_structure(std::ifstream& meta) {
-  std::string line;
-  Level_Node* cur = root;
-  Leveling_Node* level_cur = level_root;
-  int current_level = 0;
-  while (std::getline(meta, line)) {
-    // std::cout << line << std::endl;
-    std::istringstream iss(line);
-
-    if (mode == 0) {
-      if (std::isdigit(line[0])) {
-        std::string level, max_run, run_cnt;
-        if (!(iss >> level >> max_run >> run_cnt)) {
-          break;  // issue here.
-        };
-
-        if (level != "0") {
-          cur->next_level =
-              new LSM_Tree::Level_Node(cur->level + 1, cur->max_num_of_runs);
-          cur = cur->next_level;
+// this function reconstructs the lsm structure by replaying the manifest.
+// The edits are applied to lists of file names first, and the runs are only
+// opened once the final structure is known. An edit that does not fit the
+// tree throws before anything is opened or deleted, since the file it names
+// could still be live.
+void LSM_Tree::reconstruct_file_structure(
+    const std::vector<std::string>& records) {
+  std::vector<std::vector<std::string>> tiered(1);  // oldest run first
+  std::map<size_t, std::vector<std::string>> leveled;  // blocks per level
+
+  for (const auto& record : records) {
+    std::istringstream lines(record);
+    std::string line;
+    while (std::getline(lines, line)) {
+      std::istringstream iss(line);
+      std::string op, filename;
+      int level;
+      if (!(iss >> op)) {
+        continue;
+      }
+      if (op == "config") {
+        // the mode decides which levels hold runs and which hold blocks, and
+        // the last two fields are the key and value sizes the tree was
+        // built with; its files are unreadable with other settings.
+        std::string setting;
+        int saved_mode;
+        size_t key_size, value_size;
+        for (int i = 0; i < 3; i++) {
+          iss >> setting;
         }
-      } else {
-        std::string filename;
-        iss >> filename;
-
-        std::ifstream bloom("bloom_" + filename),
-            fence("fence_" + filename, std::ios::binary);
-
-        boost::dynamic_bitset<> input_bitarray;
-        bloom >> input_bitarray;
-
-        BloomFilter* bloom_filter = new BloomFilter(input_bitarray);
-
-        std::vector<KEY_t>* fence_pointer = new std::vector<KEY_t>;
-        KEY_t key;
-        while (fence.read(reinterpret_cast<char*>(&key), sizeof(KEY_t))) {
-          fence_pointer->push_back(key);
+        if (iss >> saved_mode && saved_mode != mode) {
+          throw std::runtime_error("Tree was written in mode " +
+                                   std::to_string(saved_mode) +
+                                   ", opened in mode " +
+                                   std::to_string(mode));
         }
-
-        Run run(filename, bloom_filter, fence_pointer);
-        cur->run_storage.push_back(run);
-        fence.close();
-        bloom.close();
+        for (int i = 0; i < 2; i++) {
+          iss >> setting;
+        }
+        if (iss >> key_size >> value_size &&
+            (key_size != sizeof(KEY_t) || value_size != sizeof(VALUE_t))) {
+          throw std::runtime_error(
+              "Tree was written with " + std::to_string(key_size) +
+              " byte keys and " + std::to_string(value_size) +
+              " byte values");
+        }
+        continue;
       }
-    } else if (mode == 1) {
-      int level;
-      if (std::isdigit(line[0])) {
-        // std::string level, max_run, run_cnt;
-        std::string a, b, c;
-        if (!(iss >> a)) {
-          break;  // issue here.
-        };
-        level = std::stoi(a);
-
-        if (level != 0 && level < lazy_cut_off) {
-          // reloading info back into the tiered run.
-          iss >> b >> c;  // finish loading this line.
-
-          cur->next_level =
-              new Level_Node(cur->level + 1, cur->max_num_of_runs);
-
-          cur = cur->next_level;
-        } else {
-          // reloading info back into the leveling levels.
-          if (level > lazy_cut_off) {
-            level_cur->next_level = new Leveling_Node;
-            level_cur->next_level->level = level_cur->level + 1;
-
-            float cur_FPR =
-                bloom_bits_per_entry * pow(level_ratio, level_cur->level + 1);
-            float bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
+      if (!(iss >> level) || level < 0) {
+        throw std::runtime_error("Bad manifest edit: " + line);
+      }
+      iss >> filename;
 
-            level_cur->next_level->leveled_run =
-                new Level_Run(pool, leveling_partitions, level_cur->level + 1,
-                              level_ratio, buffer_size, bloom_bits);
+      if (op == "add_level") {
+        continue;
+      }
+      bool block_edit = op == "add_block" || op == "remove_block";
+      bool run_edit = op == "add_run" || op == "remove_run";
+      bool leveled_level = mode == 1 && level >= lazy_cut_off;
+      if (leveled_level ? !block_edit : !run_edit) {
+        throw std::runtime_error("Unexpected manifest edit in mode " +
+                                 std::to_string(mode) + ": " + line);
+      }
 
-            level_cur = level_cur->next_level;
-          }
+      if (leveled_level) {
+        std::vector<std::string>& blocks = leveled[level];
+        if (op == "add_block") {
+          blocks.push_back(filename);
+        } else if (op == "remove_block") {
+          blocks.erase(std::remove(blocks.begin(), blocks.end(), filename),
+                       blocks.end());
         }
-
       } else {
-        std::string filename;
-        iss >> filename;
-        std::ifstream bloom("bloom_" + filename),
-            fence("fence_" + filename, std::ios::binary);
-
-        boost::dynamic_bitset<> input_bitarray;
-        bloom >> input_bitarray;
-
-        BloomFilter* bloom_filter = new BloomFilter(input_bitarray);
-
-        std::vector<KEY_t>* fence_pointer = new std::vector<KEY_t>;
-        KEY_t key;
-        while (fence.read(reinterpret_cast<char*>(&key), sizeof(KEY_t))) {
-          fence_pointer->push_back(key);
+        if (tiered.size() <= static_cast<size_t>(level)) {
+          tiered.resize(level + 1);
         }
-        // tiered level insert.
-        if (level < lazy_cut_off) {
-          Run run(filename, bloom_filter, fence_pointer);
-          cur->run_storage.push_back(run);
-          fence.close();
-          bloom.close();
-        } else {
-          // leveling level insert.
-          Level_Run::Node* in_level_cur = level_cur->leveled_run->root;
-          if (in_level_cur == level_cur->leveled_run->root &&
-              in_level_cur->is_empty) {
-            in_level_cur->fence_pointers = *fence_pointer;
-            in_level_cur->bloom = bloom_filter;
-            in_level_cur->file_location = filename;
-            in_level_cur->is_empty = false;
-            in_level_cur->lower = fence_pointer->front();
-            in_level_cur->upper = fence_pointer->back();
-          } else {
-            while (in_level_cur->next != nullptr) {
-              in_level_cur = in_level_cur->next;
-            }
-            in_level_cur->next = new Level_Run::Node;
-            in_level_cur = in_level_cur->next;
-            in_level_cur->fence_pointers = *fence_pointer;
-            in_level_cur->bloom = bloom_filter;
-            in_level_cur->file_location = filename;
-            in_level_cur->is_empty = false;
-            in_level_cur->lower = fence_pointer->front();
-            in_level_cur->upper = fence_pointer->back();
-          }
+        std::vector<std::string>& runs = tiered[level];
+        if (op == "add_run") {
+          runs.push_back(filename);
+        } else if (op == "remove_run") {
+          runs.erase(std::remove(runs.begin(), runs.end(), filename),
+                     runs.end());
         }
       }
     }
-    // std::cout << "meta load complete!" << std::endl;
   }
-}
 
-// this function loads the content of a full binary file.
-std::vector<Entry_t> LSM_Tree::load_full_file(
-    std::string file_location,
-    std::vector<KEY_t> fence_pointers) {
-  std::ifstream file(file_location, std::ios::binary);
-  if (!file.is_open())
-    throw std::runtime_error("Unable to open file for loading");
-
-  Entry_t entry;
-  std::vector<Entry_t> buffer;
-
-  file.seekg(0, std::ios::end);
-  size_t fileSize = file.tellg();
-  size_t read_size;
-  // read in the run's information.
-  for (int i = 0; i < fence_pointers.size(); i++) {
-    if (i * LOAD_MEMORY_PAGE_SIZE > fileSize) {
-      read_size = fileSize - (i - 1) * LOAD_MEMORY_PAGE_SIZE;
-    } else {
-      read_size = LOAD_MEMORY_PAGE_SIZE;
+  Level_Node* cur = root;
+  for (size_t level = 0; level < tiered.size(); level++) {
+    if (level > 0) {
+      cur->next_level = new Level_Node(level, cur->max_num_of_runs);
+      cur = cur->next_level;
+      total_levels++;
     }
+    for (auto& filename : tiered[level]) {
+      Run run(filename, &block_cache);
+      run.set_current_level(level);
+      cur->run_storage.push_back(run);
+    }
+  }
 
-    // read in del flags: starting * page_size -> begining of page
-    uint64_t result;
-    file.seekg(i * LOAD_MEMORY_PAGE_SIZE + read_size - BOOL_BYTE_CNT,
-               std::ios::beg);
-    file.read(reinterpret_cast<char*>(&result), BOOL_BYTE_CNT);
-    std::bitset<64> del_flag_bitset(result);
-    file.seekg(0, std::ios::beg);
-
-    std::vector<char> page_data(read_size);
-    file.seekg(i * LOAD_MEMORY_PAGE_SIZE, std::ios::beg);
-    file.read(page_data.data(), read_size);
-    // Need to figure out how to part this in one go.
+  for (auto& level_blocks : leveled) {
+    Leveling_Node* level_cur = level_root;
+    while (level_cur->level < level_blocks.first) {
+      if (!level_cur->next_level) {
+        add_leveling_level(level_cur);
+      }
+      level_cur = level_cur->next_level;
+    }
 
-    int idx = 0;
-    int cnt = 0;
-    while (idx < read_size - BOOL_BYTE_CNT) {
-      Entry_t entry;
-      std::memcpy(&entry.key, &page_data[idx], sizeof(KEY_t));
-      idx += sizeof(KEY_t);
-      std::memcpy(&entry.val, &page_data[idx], sizeof(VALUE_t));
-      idx += sizeof(KEY_t);
-      entry.del = del_flag_bitset[63 - cnt];
-      cnt++;
+    std::vector<Level_Run::Node*> nodes;
+    for (auto& filename : level_blocks.second) {
+      Level_Run::Node* node = new Level_Run::Node;
+      node->file_location = filename;
+      node->file = std::make_shared<RunFile>(filename, &block_cache);
+      node->bloom = node->file->load_metadata(node->fence_pointers);
+      node->is_empty = false;
+      node->lower = node->fence_pointers.front();
+      node->upper = node->fence_pointers.back();
+      nodes.push_back(node);
+    }
+    // blocks are disjoint, so ordering them by first key restores the list.
+    std::sort(nodes.begin(), nodes.end(),
+              [](Level_Run::Node* a, Level_Run::Node* b) {
+                return a->lower < b->lower;
+              });
+    for (size_t i = 0; i + 1 < nodes.size(); i++) {
+      nodes[i]->next = nodes[i + 1];
+    }
+    level_cur->leveled_run->root = nodes.empty() ? nullptr : nodes.front();
+  }
+}
 
-      buffer.push_back(entry);
+// delete run files that no level refers to, and temporary bulk load files. They are left behind when the process
+// stops between writing a run and logging it, or between logging a merge and
+// deleting its inputs.
+void LSM_Tree::remove_orphan_files() {
+  std::set<std::string> live;
+  for (Level_Node* cur = root; cur; cur = cur->next_level) {
+    for (auto& run : cur->run_storage) {
+      live.insert(run.get_file_location());
+    }
+  }
+  for (Leveling_Node* level_cur = level_root; level_cur;
+       level_cur = level_cur->next_level) {
+    for (Level_Run::Node* node = level_cur->leveled_run->root; node;
+         node = node->next) {
+      live.insert(node->file_location);
     }
   }
 
-  file.close();
-  return buffer;
+  std::vector<std::filesystem::path> orphans;
+  for (const auto& file : std::filesystem::directory_iterator("./")) {
+    std::string name = file.path().filename().string();
+    bool run_file = name.rfind("lsm_tree_", 0) == 0 &&
+                    file.path().extension() == ".dat";
+    bool sort_file = name.rfind("lsm_tree_bulk_", 0) == 0 &&
+                     file.path().extension() == ".sort";
+    if ((run_file && !live.count(name)) || sort_file) {
+      orphans.push_back(file.path());
+    }
+  }
+  for (auto& path : orphans) {
+    std::filesystem::remove(path);
+  }
 }
 
 std::string LSM_Tree::print() {
+  std::shared_lock<std::shared_mutex> tree_lock(tree_mutex);
   Level_Node* cur = root;
   std::ostringstream oss;
 
@@ -1218,73 +1424,9 @@ std::string LSM_Tree::print() {
 
     level_cur = level_cur->next_level;
   }
+  oss << string_tree->print();
 
   std::cout << oss.str();
 
   return oss.str();
 }
-
-/*************************************************************
- *   The following are helper function to implement merge sort
- ***************************************************************/
-
-std::vector<EntryList> LSM_Tree::splitVector(const EntryList& v, int numParts) {
-  std::vector<EntryList> parts;
-  size_t totalSize = v.size();
-  size_t partSize = totalSize / numParts;
-  size_t remain = totalSize % numParts;
-  size_t start = 0, end = 0;
-
-  for (int i = 0; i < numParts; i++) {
-    if (remain > 0) {
-      end += (partSize + 1);
-      remain--;
-    } else {
-      end += partSize;
-    }
-
-    parts.push_back(EntryList(v.begin() + start, v.begin() + end));
-    start = end;
-  }
-
-  return parts;
-}
-
-EntryList LSM_Tree::merge_s(const EntryList& leftVec,
-                            const EntryList& rightVec) {
-  EntryList merged;
-  auto left = leftVec.begin();
-  auto right = rightVec.begin();
-  auto leftEnd = leftVec.end();
-  auto rightEnd = rightVec.end();
-
-  while (left != leftEnd && right != rightEnd) {
-    if (*right < *left) {
-      merged.push_back(*right);
-      ++right;
-    } else {
-      merged.push_back(*left);
-      ++left;
-    }
-  }
-
-  merged.insert(merged.end(), left, leftEnd);
-  merged.insert(merged.end(), right, rightEnd);
-
-  return merged;
-}
-
-EntryList LSM_Tree::mergeSort(const EntryList& vec) {
-  if (vec.size() <= 1) {
-    return vec;
-  }
-
-  auto mid = vec.begin() + vec.size() / 2;
-  EntryList leftVec(vec.begin(), mid);
-  EntryList rightVec(mid, vec.end());
-
-  EntryList leftSorted = mergeSort(leftVec);
-  EntryList rightSorted = mergeSort(rightVec);
-
-  return merge_s(leftSorted, rightSorted);
-}
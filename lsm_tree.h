@@ -4,19 +4,34 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <random>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 
+#include "block_cache.h"
 #include "buffer_level.h"
+#include "compaction.h"
+#include "compaction_scheduler.h"
+#include "file_numbers.h"
 #include "key_value.h"
 #include "level_run.h"
+#include "manifest.h"
 #include "lib/ThreadPool.h"
 #include "run.h"
+#include "string_tree.h"
+#include "wal.h"
+#include "write_batch.h"
 
 // This will be changed to a key and some type of pointer that can point to
 // specific location in the file system.
@@ -29,10 +44,87 @@
 */
 typedef std::vector<Entry> EntryList;
 
+// Tuning knobs that are not part of the saved configuration, so they can
+// change between runs. main and server read them from the command line with
+// parse_options.
+struct LSM_Options {
+  // write-ahead log sync policy, see wal.h.
+  WriteAheadLog::SyncMode wal_sync_mode = WriteAheadLog::GROUP;
+  int wal_group_commit_ms = 0;
+  size_t wal_group_commit_entries = 1000;
+
+  // compaction workers and the disk traffic they may use; 0 bytes per
+  // second means unlimited.
+  size_t compaction_threads = 2;
+  size_t compaction_io_bytes_per_sec = 64 << 20;
+
+  // first level written with packed pages, and first level using the
+  // cache-line-blocked bloom filter; -1 keeps every level raw or classic.
+  // Each file records its own format, so these may change between runs.
+  int packed_page_level = 2;
+  int blocked_bloom_level = 0;
+};
+
+// read --option=value flags into an LSM_Options; throws on unknown flags.
+LSM_Options parse_options(int argc, char* argv[]);
+
+class LSM_Tree;
+// create the tree with the configuration saved in the manifest of an
+// earlier process. Its structure is rebuilt by recover_manifest.
+LSM_Tree* meta_load_save(const LSM_Options& options);
+
 class LSM_Tree {
   size_t num_of_threads;
   ThreadPool pool;
-  BufferLevel* in_mem;  // Think about destructor here.
+  BlockCache block_cache;  // pages shared by every run and leveled block
+  FileNumbers file_numbers;  // names every run and leveled block file
+  std::shared_ptr<BufferLevel> in_mem;  // active buffer taking writes.
+
+  // sealed buffers waiting to be flushed, oldest first. They stay readable
+  // until their flush has been published into the on-disk levels.
+  std::deque<std::shared_ptr<BufferLevel>> imm_mem;
+  size_t max_immutable_buffers = 2;  // puts stall only once this many are queued
+  std::mutex mem_mutex;               // guards in_mem/imm_mem swaps
+  std::condition_variable flush_cv;   // wakes the flush thread
+  std::condition_variable flush_done_cv;  // wakes writers waiting for room
+  std::thread flush_thread;
+  bool stop_flush = false;
+
+  // write-ahead log for the buffers; one segment per active/sealed buffer.
+  std::unique_ptr<WriteAheadLog> wal;
+  std::deque<uint64_t> imm_wal_segments;  // segments of imm_mem, same order
+  WriteAheadLog::SyncMode wal_sync_mode;
+  int wal_group_commit_ms;
+  size_t wal_group_commit_entries;
+
+  // readers share the on-disk structure. Flushes and compactions do their IO
+  // without it and only hold it exclusively to publish the result.
+  std::shared_mutex tree_mutex;
+
+  // compactions run on their own workers, so gets on `pool` never queue
+  // behind them. compaction_io_bytes_per_sec caps their disk traffic; 0 means
+  // unlimited.
+  size_t compaction_threads;
+  size_t compaction_io_bytes_per_sec;
+  std::unique_ptr<RateLimiter> compaction_limiter;
+  std::unique_ptr<CompactionScheduler> compactor;
+  std::condition_variable_any level0_cv;  // flushes wait while level 0 is full
+  // pause before a failed compaction is scheduled again.
+  static const int COMPACTION_RETRY_MS = 1000;
+
+  // log of structure changes; every flush and compaction appends a record
+  // before its input files are deleted.
+  std::unique_ptr<Manifest> manifest;
+
+  // string keys and values live in their own tables next to the integer
+  // runs; see string_tree.h.
+  std::unique_ptr<StringTree> string_tree;
+
+  // bulk_load sorts its input in chunks of this many entries, up to one
+  // chunk per pool thread at a time. Loads run one at a time, since they
+  // share the names of the chunk files.
+  size_t bulk_load_chunk_entries = 1 << 20;
+  std::mutex bulk_load_mutex;
 
   long total; 
   int buffer_size;
@@ -47,6 +139,10 @@ class LSM_Tree {
   bool further_optimized = false; 
   bool dynamic_level_ratio = false; 
   float leveling_flush_ratio = 0.9;
+  // first level using the blocked bloom filter; -1 keeps every level classic.
+  int blocked_bloom_level;
+  // first level written with packed pages; -1 keeps every level raw.
+  int packed_page_level;
 
   int total_levels = 1;
   /******************************************************
@@ -58,6 +154,7 @@ class LSM_Tree {
     size_t max_num_of_runs;
     Level_Node* next_level;  // point to the next_run_tree_node
     std::vector<Run> run_storage;
+    bool compacting = false;  // a compaction out of this level is scheduled
 
     // Default constructor
     Level_Node(size_t lvl, size_t numRuns, Level_Node* nextLvl = nullptr)
@@ -98,50 +195,113 @@ class LSM_Tree {
            size_t buffer_size,
            int mode,
            size_t threads, 
-           int partition);
+           int partition,
+           size_t cache_pages = 16384,  // ~8MB of 520 byte pages
+           const LSM_Options& options = LSM_Options());
   ~LSM_Tree();
 
   void put(KEY_t key, VALUE_t val);
-  void put(Entry_t entry);  // overload for loading saved memory.
+  void put(Entry_t entry);  // shared write path for puts and deletes.
+  uint64_t insert(const Entry_t& entry);
+  // applies the whole batch at once, or throws if it cannot fit the buffer.
+  void write(const WriteBatch& batch);
+  // load a binary file of (key, val) pairs straight into a sorted run.
+  void bulk_load(const std::string& file_path);
 
   std::unique_ptr<Entry_t> get(KEY_t key);
+  // one result per key, in the order given; null when the key is absent.
+  std::vector<std::unique_ptr<Entry_t>> multi_get(
+      const std::vector<KEY_t>& keys);
   std::unique_ptr<Entry_t> process_run(
       typename std::vector<Run>::reverse_iterator rit,
       const KEY_t& key);
+  std::unique_ptr<Entry_t> first_result(
+      std::vector<std::future<std::unique_ptr<Entry_t>>>& futures);
 
-  std::vector<Entry_t> range(KEY_t lower, KEY_t upper);
+  // sorted live entries with lower <= key <= upper; limit 0 means no limit.
+  std::vector<Entry_t> range(KEY_t lower, KEY_t upper, size_t limit = 0);
   void del(KEY_t key);
 
+  // the string key/value tables, recovered and saved with the tree.
+  StringTree* strings() { return string_tree.get(); }
+
+  /**
+   * Iterator
+   * A sorted scan over the whole tree. It snapshots the buffers and the list
+   * of run/block files when created and then merges them lazily in key
+   * order, holding one page per source. Deleted keys are skipped. Files
+   * replaced by later merges stay readable through the iterator's open
+   * handles, so the view does not change while it is in use. With an upper
+   * bound the scan ends after that key and no page past it is read.
+   */
+  class Iterator {
+    std::vector<std::vector<Entry_t>> mem_entries;  // buffer copies
+    std::unique_ptr<MergingIterator> merged;
+    KEY_t upper_bound;
+
+    void skip_deleted();
+
+   public:
+    explicit Iterator(LSM_Tree& tree, KEY_t upper_bound = MAX_KEY);
+    Iterator(const Iterator&) = delete;
+    Iterator& operator=(const Iterator&) = delete;
+
+    void SeekToFirst();
+    void Seek(KEY_t key);  // position at the first key >= key
+    bool Valid() const;
+    void Next();
+    const Entry_t& entry() const;
+  };
+  std::unique_ptr<Iterator> new_iterator(KEY_t upper_bound = MAX_KEY);
+
+  // buffer handoff to the background flush thread
+  void seal_buffer(std::unique_lock<std::mutex>& lock);
+  void flush_loop();
+  void wait_for_flush();
+  void recover_wal();
+  std::vector<std::shared_ptr<BufferLevel>> memory_snapshot();
+
   // merge policies
-  void merge_policy();
-  std::unordered_map<KEY_t, Entry_t> merge(Level_Node*& cur);
-  std::unordered_map<KEY_t, Entry_t> partial_merge(Leveling_Node*& cur);
+  void flush_buffer(EntryList buffer);
+  void schedule_compactions();
+  void compact_level(Level_Node* cur);
+  void merge_level(Level_Node* cur);
+  void compact_into_leveling(Level_Node* cur,
+                             std::vector<MergeSource>& sources,
+                             size_t merged_cnt);
+  void push_down_leveling();
+  Leveling_Node* add_leveling_level(Leveling_Node* level_cur);
+  void collect_tiered_sources(Level_Node* cur, std::vector<MergeSource>& sources);
 
-  Run create_run(std::vector<Entry_t>, int);
-  void create_bloom_filter(BloomFilter* bloom, const std::vector<Entry_t>& vec);
-  void save_to_memory(std::string filename,
-                      std::vector<KEY_t>* fence_pointer,
-                      std::vector<Entry_t>& vec);
+  bool is_bottom(Level_Node* target);
+  void publish_run(Level_Node* target, Run& run, VersionEdit& edit);
+  std::vector<std::string> retire_runs(Level_Node* cur,
+                                       size_t cnt,
+                                       VersionEdit& edit);
+  void splice_edit(int level,
+                   const Level_Run::Splice& splice,
+                   VersionEdit& edit);
+  void log_edit(const VersionEdit& edit);
+  Run create_run(std::vector<MergeSource>& sources,
+                 int current_level,
+                 bool drop_tombstones = false,
+                 RateLimiter* limiter = nullptr);
+  BloomFilter::Type bloom_type(int level);
+  PageFormat page_format(int level);
 
   // saving files on quit command
-  void exit_save_memory();
-  void level_meta_save();
+  void manifest_snapshot();
   void exit_save();
 
   // Loading functions
-  void load_memory();
-  void reconstruct_file_structure(std::ifstream& meta);
-  std::vector<Entry_t> load_full_file(std::string file_location,
-                                      std::vector<KEY_t> fence_pointers);
+  void recover_manifest();
+  void reconstruct_file_structure(const std::vector<std::string>& records);
+  void remove_orphan_files();
 
   // helper functions
   std::string print();
-  std::string generateRandomString(size_t length);
+  std::string generate_file_name();
   void print_statistics();
-
-  std::vector<EntryList> splitVector(const EntryList& v, int numParts);
-  EntryList merge_s(const EntryList& leftVec, const EntryList& rightVec);
-  EntryList mergeSort(const EntryList& vec);
 };
 
 #endif
\ No newline at end of file
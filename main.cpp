@@ -1,5 +1,5 @@
 // g++ -g -pthread  main.cpp bloom.cpp run.cpp lsm_tree.cpp 
-// level_run.cpp -o program
+// level_run.cpp string_tree.cpp -o program
 #include <filesystem>
 #include <iostream>
 #include <sstream>
@@ -7,6 +7,7 @@
 #include "buffer_level.h"
 #include "level_run.h"
 #include "lsm_tree.h"
+#include "manifest.h"
 #include "run.h"
 
 namespace fs = std::filesystem;
@@ -23,146 +24,137 @@ void command_loop(LSM_Tree* tree) {
       break;  // Exit the loop
     }
 
-    switch (command) {
-      case 'p': {  // put
-        std::cin >> key_a >> val;
-        if (val < MIN_VAL || val > MAX_VAL) {
-          std::cout << "Could not insert value " << std::to_string(val)
-                    << ": out of range." << std::endl;
-        } else {
-          tree->put(key_a, val);
+    try {
+      switch (command) {
+        case 'p': {  // put
+          std::cin >> key_a >> val;
+          if (val < MIN_VAL || val > MAX_VAL) {
+            std::cout << "Could not insert value " << std::to_string(val)
+                      << ": out of range." << std::endl;
+          } else {
+            tree->put(key_a, val);
+          }
+          break;
         }
-        break;
-      }
-      case 'g': {  // get
-        std::cin >> key_a;
-        if (key_a < MIN_VAL || key_a > MAX_VAL) {
-          std::cout << "Could not search value " << std::to_string(key_a)
-                    << ": out of range." << std::endl;
+        case 'g': {  // get
+          std::cin >> key_a;
+          if (key_a < MIN_VAL || key_a > MAX_VAL) {
+            std::cout << "Could not search value " << std::to_string(key_a)
+                      << ": out of range." << std::endl;
+          }
+          std::unique_ptr<Entry> entry = tree->get(key_a);
+          if (entry && !entry->del) {
+            std::cout << *entry << std::endl;
+          } else {
+            std::cout << key_a << " Not found" << std::endl;
+          }
+          break;
         }
-        std::unique_ptr<Entry> entry = tree->get(key_a);
-        if (entry && !entry->del) {
-          std::cout << *entry << std::endl;
-        } else {
-          std::cout << key_a << " Not found" << std::endl;
+        case 'm': {  // get a batch of keys: m key1 key2 ...
+          std::string line;
+          std::getline(std::cin, line);
+          std::istringstream keys_in(line);
+          std::vector<KEY_t> keys;
+          while (keys_in >> key_a) {
+            keys.push_back(key_a);
+          }
+
+          auto entries = tree->multi_get(keys);
+          for (size_t i = 0; i < keys.size(); i++) {
+            if (entries[i] && !entries[i]->del) {
+              std::cout << *entries[i] << std::endl;
+            } else {
+              std::cout << keys[i] << " Not found" << std::endl;
+            }
+          }
+          break;
         }
-        break;
-      }
-      case 'r': {  // range
-        std::cin >> key_a >> key_b;
-        std::vector<Entry_t> ret;
-
-        if (key_a < MIN_VAL || key_a > MAX_VAL) {
-          std::cout << "Could not search value " << std::to_string(key_a)
-                    << ": out of range." << std::endl;
-        } else if (key_b < MIN_VAL || key_b > MAX_VAL) {
-          std::cout << "Could not search value " << std::to_string(key_b)
-                    << ": out of range." << std::endl;
-        } else {
-          ret = tree->range(key_a, key_b);
+        case 'r': {  // range
+          std::cin >> key_a >> key_b;
+          std::vector<Entry_t> ret;
+
+          if (key_a < MIN_VAL || key_a > MAX_VAL) {
+            std::cout << "Could not search value " << std::to_string(key_a)
+                      << ": out of range." << std::endl;
+          } else if (key_b < MIN_VAL || key_b > MAX_VAL) {
+            std::cout << "Could not search value " << std::to_string(key_b)
+                      << ": out of range." << std::endl;
+          } else {
+            ret = tree->range(key_a, key_b);
+          }
+
+          // if (ret.size() > 0) {
+          //   std::cout << "Range found" << std::endl;
+          // }
+
+          for (Entry_t entry : ret) {
+            if (!entry.del) {
+              std::cout << entry.key << ":" << entry.val << std::endl;
+            } 
+          }
+          break;
         }
-
-        // if (ret.size() > 0) {
-        //   std::cout << "Range found" << std::endl;
-        // }
-
-        for (Entry_t entry : ret) {
-          if (!entry.del) {
-            std::cout << entry.key << ":" << entry.val << std::endl;
-          } 
+        case 'd': {  // delete
+          std::cin >> key_a;
+          tree->del(key_a);
+          break;
         }
-        break;
-      }
-      case 'd': {  // delete
-        std::cin >> key_a;
-        tree->del(key_a);
-        break;
-      }
-      case 'l': {  // load from binary file.
-        std::string file_path;
-        std::cin >> file_path;
-        std::ifstream file(file_path, std::ios::binary);
-        Entry_t entry;
-        if (!file) {
-          throw std::runtime_error("Cannot open file: " + file_path);
+        case 'l': {  // load from binary file.
+          std::string file_path;
+          std::cin >> file_path;
+          // sorted into runs directly instead of one put per pair.
+          tree->bulk_load(file_path);
+          // std::cout << "loaded file " << file_path << std::endl; 
+          break;
         }
-
-        file.seekg(0, std::ios::end);
-        size_t file_size = file.tellg();
-        file.seekg(0, std::ios::beg);
-
-        std::vector<char> file_data(file_size);
-        if (!file.read(file_data.data(), file_size)) {
-          std::cerr << "Error reading file.\n";
+        // string keys and values: P key val, G key, D key, R lower upper.
+        // Keys and values are single words.
+        case 'P': {
+          std::string key, value;
+          std::cin >> key >> value;
+          tree->strings()->put(key, value);
+          break;
         }
-        // read in the run's information.
-        int idx = 0;
-        while (file_size > 0) {
-          // Entry_t entry;
-          std::memcpy(&entry.key, &file_data[idx], sizeof(KEY_t));
-          idx += sizeof(KEY_t);
-          std::memcpy(&entry.val, &file_data[idx], sizeof(VALUE_t));
-          idx += sizeof(VALUE_t);
-
-          tree->put(entry.key, entry.val);
-          file_size = file_size - (sizeof(VALUE_t) + sizeof(KEY_t));
+        case 'G': {
+          std::string key;
+          std::cin >> key;
+          auto entry = tree->strings()->get(key);
+          if (entry && !entry->del) {
+            std::cout << *entry << std::endl;
+          } else {
+            std::cout << key << " Not found" << std::endl;
+          }
+          break;
         }
-
-        file.close();
-        // std::cout << "loaded file " << file_path << std::endl; 
-        break;
-      }
-      case 's': {  // print current LSM tree view
-        tree->print();
-        break;
+        case 'D': {
+          std::string key;
+          std::cin >> key;
+          tree->strings()->del(key);
+          break;
+        }
+        case 'R': {
+          std::string lower, upper;
+          std::cin >> lower >> upper;
+          for (const StringEntry& entry : tree->strings()->range(lower, upper)) {
+            std::cout << entry.key << ":" << entry.val << std::endl;
+          }
+          break;
+        }
+        case 's': {  // print current LSM tree view
+          tree->print();
+          break;
+        }
+        default:
+          std::cout << "Invalid command." << std::endl;
+          break;
       }
-      default:
-        std::cout << "Invalid command." << std::endl;
-        break;
+    } catch (const CorruptionError& e) {
+      // a page failed its checksum; report it and keep serving commands.
+      std::cout << "Corrupt data: " << e.what() << std::endl;
     }
   }
 }
 
-// load data on start up.
-LSM_Tree* meta_load_save() {
-  std::string meta_data = "lsm_tree_level_meta.txt";
-  std::ifstream meta(meta_data);
-
-  if (!meta.is_open()) {
-    std::cerr << "Failed to open the meta file." << std::endl;
-  }
-
-  std::string line;
-
-  // read in the lsm tree meta data (in first line)
-  float bits_per_entry;
-  int level_ratio, buffer_size, mode, threads, partition;
-  std::string a, b, c, d, e, f;
-  if (std::getline(meta, line)) {
-    std::istringstream iss(line);
-    if (!(iss >> a >> b >> c >> d >> e >> f)) {
-      std::cerr << "error loading lsm isntance meta data" << std::endl;
-    };
-    bits_per_entry = std::stof(a);
-    level_ratio = std::stoi(b);
-    buffer_size = std::stoi(c);
-    mode = std::stoi(d);
-    threads = std::stoi(e);
-    partition = std::stoi(f);
-  } else {
-    std::cout << "Error reading LSM tree instance meta data" << std::endl;
-  }
-
-  LSM_Tree* lsm_tree = new LSM_Tree(bits_per_entry, level_ratio, buffer_size,
-                                    mode, threads, partition);
-
-  lsm_tree->load_memory();
-  lsm_tree->reconstruct_file_structure(meta);
-  // std::cout << "done with meta read" << std::endl;
-  meta.close();
-  return lsm_tree;
-};
-
 int main(int argc, char* argv[]) {
   int opt;
   size_t buffer_size, test_size;
@@ -177,14 +169,14 @@ int main(int argc, char* argv[]) {
   // }
 
   // std::cout << "\n basic LSM tree benchmark \n" << std::endl;
-  std::string meta_data_path = "lsm_tree_level_meta.txt";
-  std::string memory_data_path = "lsm_tree_memory.dat";
-
   LSM_Tree* lsm_tree;
+  // tuning flags such as --wal-sync=every; the tree configuration itself
+  // comes from the manifest or stdin.
+  LSM_Options options = parse_options(argc, argv);
 
-  if (fs::exists(meta_data_path) && fs::exists(memory_data_path)) {
+  if (Manifest::exists()) {
     // std::cout << "All save files are present. Loading data..." << std::endl;
-    lsm_tree = meta_load_save();
+    lsm_tree = meta_load_save(options);
   } else {
     float bits_per_entry;
     int level_ratio, buffer_size, mode, threads, leveling_partition;
@@ -201,8 +193,12 @@ int main(int argc, char* argv[]) {
     // leveling_partition =10;
 
     lsm_tree = new LSM_Tree(bits_per_entry, level_ratio, buffer_size, mode,
-                            threads, leveling_partition);
+                            threads, leveling_partition, 16384, options);
   }
+  // rebuild the runs on disk, then replay the buffer contents from the
+  // write-ahead log.
+  lsm_tree->recover_manifest();
+  lsm_tree->recover_wal();
 
   /*
       Testing without command loop.
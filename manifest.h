@@ -0,0 +1,212 @@
+// This class implements the manifest: an append-only log of the changes made
+// to the on-disk structure of the tree, stored in lsm_tree_MANIFEST.log.
+// Every flush, compaction and bulk load appends one record, synced before the
+// files it replaces are deleted, so replaying the log after a crash gives the
+// structure as of the last completed change. On startup the log is replaced
+// by a snapshot of the current structure so it does not grow without bound.
+//
+// A record is [uint32 length][uint32 crc32c][length bytes of text], one edit
+// per line:
+//   config <bits_per_entry> <level_ratio> <buffer_size> <mode> <threads>
+//          <partitions> <key_bytes> <value_bytes>
+//   add_level <level>
+//   add_run <level> <file>       (the newest run of a tiered level)
+//   remove_run <level> <file>
+//   add_block <level> <file>     (a block of a leveled level)
+//   remove_block <level> <file>
+// A torn record at the tail is ignored on replay, but a complete record that
+// fails its crc is corruption: the files it names could be live, so replay
+// stops the tree from opening rather than drop it. The log is
+// only opened for appends once the first snapshot has been renamed into
+// place, so a crash never leaves an empty manifest. A run's bloom filter and
+// fence pointers are read back from the footer of its own file. The string
+// tables (see string_tree.h) keep a manifest of their own under another name.
+#pragma once
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "crc32c.h"
+#include "key_value.h"
+
+// flush a file, or a directory's entries, to stable storage.
+inline void sync_path(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+// A group of changes to the tree structure that is logged as one record, so
+// replay applies all of them or none.
+class VersionEdit {
+  std::ostringstream record;
+
+ public:
+  void add_level(int level) { record << "add_level " << level << "\n"; }
+  void add_run(int level, const std::string& file) {
+    record << "add_run " << level << " " << file << "\n";
+  }
+  void remove_run(int level, const std::string& file) {
+    record << "remove_run " << level << " " << file << "\n";
+  }
+  void add_block(int level, const std::string& file) {
+    record << "add_block " << level << " " << file << "\n";
+  }
+  void remove_block(int level, const std::string& file) {
+    record << "remove_block " << level << " " << file << "\n";
+  }
+
+  // the garbage count of a value log segment; see value_log.h.
+  void vlog_dead(uint64_t segment, uint64_t bytes) {
+    record << "vlog_dead " << segment << " " << bytes << "\n";
+  }
+  // a value log segment that tables or logs may point to, and one that was
+  // collected and can be deleted.
+  void vlog_ref(uint64_t segment) { record << "vlog_ref " << segment << "\n"; }
+  void vlog_drop(uint64_t segment) {
+    record << "vlog_drop " << segment << "\n";
+  }
+
+  std::string encode() const { return record.str(); }
+  bool empty() const { return record.str().empty(); }
+};
+
+class Manifest {
+ public:
+  static constexpr const char* DEFAULT_NAME = "lsm_tree_MANIFEST.log";
+
+ private:
+  std::mutex mutex;
+  int fd = -1;
+  std::string file_name;
+
+  static const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+
+  static std::string frame(const std::string& record) {
+    uint32_t len = record.size();
+    uint32_t crc = crc32c::value(record.data(), record.size());
+    std::string out(HEADER_SIZE, '\0');
+    std::memcpy(&out[0], &len, sizeof(len));
+    std::memcpy(&out[sizeof(len)], &crc, sizeof(crc));
+    return out + record;
+  }
+
+  static void write_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+      if (n < 0) {
+        throw std::runtime_error("Failed to write to manifest");
+      }
+      done += n;
+    }
+  }
+
+  void open_log() {
+    fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open manifest");
+    }
+  }
+
+ public:
+  // nothing can be appended until rewrite() has written the first snapshot.
+  explicit Manifest(std::string name = DEFAULT_NAME)
+      : file_name(std::move(name)) {}
+
+  ~Manifest() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  Manifest(const Manifest&) = delete;
+  Manifest& operator=(const Manifest&) = delete;
+
+  // an empty file holds no tree; it is left by older versions that created
+  // the log before writing the first snapshot.
+  static bool exists(const std::string& name = DEFAULT_NAME) {
+    std::error_code ec;
+    return std::filesystem::file_size(name, ec) > 0 && !ec;
+  }
+
+  // every complete record, in order.
+  static std::vector<std::string> read_records(
+      const std::string& name = DEFAULT_NAME) {
+    std::vector<std::string> ret;
+    std::ifstream in(name, std::ios::binary);
+    if (!in.is_open()) {
+      return ret;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    while (pos + HEADER_SIZE <= data.size()) {
+      uint32_t len, crc;
+      std::memcpy(&len, &data[pos], sizeof(len));
+      std::memcpy(&crc, &data[pos + sizeof(len)], sizeof(crc));
+      if (pos + HEADER_SIZE + len > data.size()) {
+        break;  // torn write at the tail.
+      }
+      pos += HEADER_SIZE;
+      if (crc32c::value(&data[pos], len) != crc) {
+        throw std::runtime_error("Corrupt record in " + name);
+      }
+      ret.emplace_back(&data[pos], len);
+      pos += len;
+    }
+    return ret;
+  }
+
+  // durably log one record. The directory is synced first so the files the
+  // record names are reachable after a crash.
+  void append(const std::string& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0) {
+      throw std::runtime_error("Manifest appended to before its snapshot");
+    }
+    sync_path(".");
+    write_all(fd, frame(record));
+    ::fdatasync(fd);
+  }
+
+  // replace the whole log with the given records. The new log is written
+  // aside and renamed over the old one, so a crash leaves either of them.
+  void rewrite(const std::vector<std::string>& records) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string tmp_name = file_name + ".tmp";
+    int tmp_fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd < 0) {
+      throw std::runtime_error("Unable to write manifest snapshot");
+    }
+    for (const auto& record : records) {
+      write_all(tmp_fd, frame(record));
+    }
+    ::fsync(tmp_fd);
+    ::close(tmp_fd);
+
+    std::filesystem::rename(tmp_name, file_name);
+    sync_path(".");
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    open_log();
+  }
+};
+
+#endif
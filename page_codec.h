@@ -0,0 +1,245 @@
+// Packed page encoding for the deep levels. A packed page holds the same
+// entries as a raw page (see page_search.h) in fewer bytes:
+//   [kind][entry_cnt][key_bits][val_bits][min_delta][first_key][min_val]
+//   [delete bitmap, only if an entry is deleted]
+//   [key deltas, bit packed][values, bit packed]
+// Keys are sorted, so each key after the first is stored as its distance to
+// the previous key minus the smallest such distance. Values are stored
+// relative to the smallest value of the page. Both use the fewest bits that
+// fit the largest number, up to 32. A page that does not shrink, needs wider
+// numbers, or has non-integer values is stored raw behind its kind byte.
+//
+// Decoding expands a packed page back into the raw format, so the page
+// search code and the block cache only ever see raw pages. The unpack loop
+// has a fixed width and no branches, which the compiler vectorizes.
+#pragma once
+#ifndef PAGE_CODEC_H
+#define PAGE_CODEC_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "key_value.h"
+#include "page_search.h"
+
+// how the pages of a run file are stored, recorded in its footer.
+enum PageFormat : uint32_t { PAGE_RAW = 0, PAGE_PACKED = 1 };
+
+// room for the largest stored page plus the slack the bit unpacker reads
+// past the end of its input.
+const int PACKED_PAGE_BUFFER = LOAD_MEMORY_PAGE_SIZE + 32;
+
+namespace page_codec {
+
+enum Kind : uint8_t { STORED_RAW = 0, PACKED = 1, PACKED_WITH_DELETES = 2 };
+
+inline int bit_width(uint64_t max_value) {
+  return max_value == 0 ? 0 : 64 - __builtin_clzll(max_value);
+}
+
+// write n values of width bits each to out, which must be zeroed and have
+// 8 bytes of slack. Returns the bytes used.
+inline size_t pack_bits(const uint32_t* in, int n, int width, char* out) {
+  for (int i = 0; i < n; i++) {
+    size_t bit = static_cast<size_t>(i) * width;
+    uint64_t word;
+    std::memcpy(&word, out + bit / 8, sizeof(word));
+    word |= static_cast<uint64_t>(in[i]) << (bit % 8);
+    std::memcpy(out + bit / 8, &word, sizeof(word));
+  }
+  return (static_cast<size_t>(n) * width + 7) / 8;
+}
+
+// read n values of width bits each from in, which must have 8 readable bytes
+// past the packed data. Returns the bytes consumed.
+inline size_t unpack_bits(const char* in, int n, int width, uint32_t* out) {
+  const uint64_t mask = (static_cast<uint64_t>(1) << width) - 1;
+  for (int i = 0; i < n; i++) {
+    size_t bit = static_cast<size_t>(i) * width;
+    uint64_t word;
+    std::memcpy(&word, in + bit / 8, sizeof(word));
+    out[i] = static_cast<uint32_t>((word >> (bit % 8)) & mask);
+  }
+  return (static_cast<size_t>(n) * width + 7) / 8;
+}
+
+
+const int HEADER_SIZE = 8 + sizeof(KEY_t) + sizeof(VALUE_t);
+
+inline size_t store_raw(const char* page, size_t page_bytes, char* out) {
+  out[0] = STORED_RAW;
+  std::memcpy(out + 1, page, page_bytes);
+  return page_bytes + 1;
+}
+
+}  // namespace page_codec
+
+// encode a raw page of page_bytes bytes into out, which holds at least
+// PACKED_PAGE_BUFFER bytes. Returns the stored size. Only integer values are
+// packed, so the packing code is compiled for those types alone.
+template <typename K = KEY_t, typename V = VALUE_t>
+size_t page_pack(const char* page, size_t page_bytes, char* out) {
+  using namespace page_codec;
+  std::memset(out, 0, PACKED_PAGE_BUFFER);
+  if constexpr (!std::is_integral<V>::value) {
+    return store_raw(page, page_bytes, out);
+  } else {
+    typedef typename std::make_unsigned<K>::type UKEY_t;
+    typedef typename std::make_unsigned<V>::type UVALUE_t;
+    const int entry_cnt = (page_bytes - BOOL_BYTE_CNT) / PAGE_ENTRY_SIZE;
+    if (entry_cnt == 0) {
+      return store_raw(page, page_bytes, out);  // nothing to pack
+    }
+
+    K keys[PAGE_ENTRY_CNT];
+    V vals[PAGE_ENTRY_CNT];
+    for (int i = 0; i < entry_cnt; i++) {
+      std::memcpy(&keys[i], page + i * PAGE_ENTRY_SIZE, sizeof(K));
+      std::memcpy(&vals[i], page + i * PAGE_ENTRY_SIZE + sizeof(K),
+                  sizeof(V));
+    }
+    uint64_t del_bits;
+    std::memcpy(&del_bits, page + page_bytes - BOOL_BYTE_CNT, BOOL_BYTE_CNT);
+
+    // differences are taken in the unsigned type, where they cannot overflow.
+    uint64_t deltas[PAGE_ENTRY_CNT];
+    uint64_t min_delta = entry_cnt > 1 ? UINT64_MAX : 0, max_delta = 0;
+    for (int i = 1; i < entry_cnt; i++) {
+      deltas[i - 1] = static_cast<UKEY_t>(static_cast<UKEY_t>(keys[i]) -
+                                          static_cast<UKEY_t>(keys[i - 1]));
+      min_delta = std::min(min_delta, deltas[i - 1]);
+    }
+    for (int i = 0; i + 1 < entry_cnt; i++) {
+      max_delta = std::max(max_delta, deltas[i] - min_delta);
+    }
+
+    V min_val = *std::min_element(vals, vals + entry_cnt);
+    uint64_t val_offsets[PAGE_ENTRY_CNT];
+    uint64_t max_val_offset = 0;
+    for (int i = 0; i < entry_cnt; i++) {
+      val_offsets[i] = static_cast<UVALUE_t>(static_cast<UVALUE_t>(vals[i]) -
+                                             static_cast<UVALUE_t>(min_val));
+      max_val_offset = std::max(max_val_offset, val_offsets[i]);
+    }
+    // the bit streams hold at most 32 bits per number.
+    if (min_delta > UINT32_MAX || max_delta > UINT32_MAX ||
+        max_val_offset > UINT32_MAX) {
+      return store_raw(page, page_bytes, out);
+    }
+
+    uint32_t key_stream[PAGE_ENTRY_CNT];
+    uint32_t val_stream[PAGE_ENTRY_CNT];
+    for (int i = 0; i + 1 < entry_cnt; i++) {
+      key_stream[i] = static_cast<uint32_t>(deltas[i] - min_delta);
+    }
+    for (int i = 0; i < entry_cnt; i++) {
+      val_stream[i] = static_cast<uint32_t>(val_offsets[i]);
+    }
+
+    const int key_bits = bit_width(max_delta);
+    const int val_bits = bit_width(max_val_offset);
+    size_t packed_size =
+        HEADER_SIZE + (del_bits ? BOOL_BYTE_CNT : 0) +
+        (static_cast<size_t>(entry_cnt - 1) * key_bits + 7) / 8 +
+        (static_cast<size_t>(entry_cnt) * val_bits + 7) / 8;
+    if (packed_size >= page_bytes + 1) {
+      return store_raw(page, page_bytes, out);
+    }
+
+    uint32_t min_delta32 = static_cast<uint32_t>(min_delta);
+    out[0] = del_bits ? PACKED_WITH_DELETES : PACKED;
+    out[1] = static_cast<char>(entry_cnt);
+    out[2] = static_cast<char>(key_bits);
+    out[3] = static_cast<char>(val_bits);
+    std::memcpy(out + 4, &min_delta32, sizeof(min_delta32));
+    std::memcpy(out + 8, &keys[0], sizeof(K));
+    std::memcpy(out + 8 + sizeof(K), &min_val, sizeof(V));
+    size_t pos = HEADER_SIZE;
+    if (del_bits) {
+      std::memcpy(out + pos, &del_bits, BOOL_BYTE_CNT);
+      pos += BOOL_BYTE_CNT;
+    }
+    pos += pack_bits(key_stream, entry_cnt - 1, key_bits, out + pos);
+    pos += pack_bits(val_stream, entry_cnt, val_bits, out + pos);
+    return pos;
+  }
+}
+
+// decode a stored page into the raw format. in must be readable for 8 bytes
+// past stored_bytes; page holds LOAD_MEMORY_PAGE_SIZE bytes. Returns the raw
+// page size, or 0 if the stored page is malformed.
+template <typename K = KEY_t, typename V = VALUE_t>
+size_t page_unpack(const char* in, size_t stored_bytes, char* page) {
+  using namespace page_codec;
+  if (stored_bytes < 1) {
+    return 0;
+  }
+  if (in[0] == STORED_RAW) {
+    size_t page_bytes = stored_bytes - 1;
+    if (page_bytes > static_cast<size_t>(LOAD_MEMORY_PAGE_SIZE)) {
+      return 0;
+    }
+    std::memcpy(page, in + 1, page_bytes);
+    return page_bytes;
+  }
+  if constexpr (!std::is_integral<V>::value) {
+    return 0;
+  } else {
+    typedef typename std::make_unsigned<K>::type UKEY_t;
+    typedef typename std::make_unsigned<V>::type UVALUE_t;
+    if (stored_bytes < static_cast<size_t>(HEADER_SIZE)) {
+      return 0;
+    }
+
+    const int entry_cnt = static_cast<uint8_t>(in[1]);
+    const int key_bits = static_cast<uint8_t>(in[2]);
+    const int val_bits = static_cast<uint8_t>(in[3]);
+    if (entry_cnt < 1 || entry_cnt > PAGE_ENTRY_CNT || key_bits > 32 ||
+        val_bits > 32) {
+      return 0;
+    }
+    uint32_t min_delta;
+    K first_key;
+    V min_val;
+    std::memcpy(&min_delta, in + 4, sizeof(min_delta));
+    std::memcpy(&first_key, in + 8, sizeof(K));
+    std::memcpy(&min_val, in + 8 + sizeof(K), sizeof(V));
+
+    size_t pos = HEADER_SIZE;
+    uint64_t del_bits = 0;
+    if (in[0] == PACKED_WITH_DELETES) {
+      std::memcpy(&del_bits, in + pos, BOOL_BYTE_CNT);
+      pos += BOOL_BYTE_CNT;
+    }
+    uint32_t deltas[PAGE_ENTRY_CNT];
+    uint32_t val_offsets[PAGE_ENTRY_CNT];
+    pos += unpack_bits(in + pos, entry_cnt - 1, key_bits, deltas);
+    pos += unpack_bits(in + pos, entry_cnt, val_bits, val_offsets);
+    if (pos != stored_bytes) {
+      return 0;
+    }
+
+    // rebuild the keys with a running sum, then write them out with their
+    // values as (key, val) pairs.
+    K keys[PAGE_ENTRY_CNT];
+    UKEY_t key_sum = static_cast<UKEY_t>(first_key);
+    keys[0] = first_key;
+    for (int i = 1; i < entry_cnt; i++) {
+      key_sum += static_cast<UKEY_t>(deltas[i - 1]) + min_delta;
+      keys[i] = static_cast<K>(key_sum);
+    }
+    for (int i = 0; i < entry_cnt; i++) {
+      V val = static_cast<V>(static_cast<UVALUE_t>(min_val) +
+                                         val_offsets[i]);
+      std::memcpy(page + i * PAGE_ENTRY_SIZE, &keys[i], sizeof(K));
+      std::memcpy(page + i * PAGE_ENTRY_SIZE + sizeof(K), &val,
+                  sizeof(V));
+    }
+    std::memcpy(page + entry_cnt * PAGE_ENTRY_SIZE, &del_bits, BOOL_BYTE_CNT);
+    return entry_cnt * PAGE_ENTRY_SIZE + BOOL_BYTE_CNT;
+  }
+}
+
+#endif
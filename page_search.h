@@ -0,0 +1,146 @@
+// Helpers for searching a single page that has already been read into memory.
+// A page holds up to PAGE_ENTRY_CNT sorted (key, val) pairs back to back,
+// followed by the 8 byte delete bitmap. For 4 byte keys and values the AVX2
+// scan is picked at runtime when the CPU has it; otherwise a branchless
+// binary search over the sorted keys is used.
+#pragma once
+#ifndef PAGE_SEARCH_H
+#define PAGE_SEARCH_H
+
+#include <bitset>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "key_value.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAGE_SEARCH_X86 1
+#endif
+
+inline KEY_t page_key_at(const char* page, int idx) {
+  KEY_t key;
+  std::memcpy(&key, page + idx * PAGE_ENTRY_SIZE, sizeof(KEY_t));
+  return key;
+}
+
+// returns the slot holding key, or -1. Keys in a page are sorted and unique.
+inline int page_binary_search(const char* page, int entry_cnt, KEY_t key) {
+  if (entry_cnt <= 0) {
+    return -1;
+  }
+  int base = 0, n = entry_cnt;
+  while (n > 1) {
+    int half = n / 2;
+    base = (page_key_at(page, base + half) <= key) ? base + half : base;
+    n -= half;
+  }
+  return page_key_at(page, base) == key ? base : -1;
+}
+
+#ifdef PAGE_SEARCH_X86
+// compares 4 interleaved (key, val) pairs per instruction; only the even
+// 32-bit lanes are keys, so odd lanes are masked out of the result.
+__attribute__((target("avx2"))) inline int page_simd_search(const char* page,
+                                                            int entry_cnt,
+                                                            KEY_t key) {
+  const __m256i target = _mm256_set1_epi32(key);
+  int idx = 0;
+  for (; idx + 4 <= entry_cnt; idx += 4) {
+    __m256i pairs = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(page + idx * PAGE_ENTRY_SIZE));
+    int mask = _mm256_movemask_ps(
+                   _mm256_castsi256_ps(_mm256_cmpeq_epi32(pairs, target))) &
+               0x55;
+    if (mask) {
+      return idx + __builtin_ctz(mask) / 2;
+    }
+  }
+  for (; idx < entry_cnt; idx++) {
+    if (page_key_at(page, idx) == key) {
+      return idx;
+    }
+  }
+  return -1;
+}
+#endif
+
+typedef int (*PageSearchFn)(const char*, int, KEY_t);
+
+inline PageSearchFn select_page_search() {
+#ifdef PAGE_SEARCH_X86
+  // the scan compares 32-bit lanes of interleaved 8 byte pairs.
+  if (sizeof(KEY_t) == 4 && sizeof(VALUE_t) == 4 &&
+      __builtin_cpu_supports("avx2")) {
+    return page_simd_search;
+  }
+#endif
+  return page_binary_search;
+}
+
+// search a loaded page with the best implementation for this CPU.
+inline int page_search(const char* page, int entry_cnt, KEY_t key) {
+  static const PageSearchFn impl = select_page_search();
+  return impl(page, entry_cnt, key);
+}
+
+// look key up in a loaded page of page_bytes bytes; nullptr when it is not
+// there. A deleted entry is returned with its del flag set.
+inline std::unique_ptr<Entry_t> page_get(const char* page,
+                                         size_t page_bytes,
+                                         KEY_t key) {
+  if (page_bytes <= BOOL_BYTE_CNT) {
+    return nullptr;
+  }
+  int entry_cnt = (page_bytes - BOOL_BYTE_CNT) / PAGE_ENTRY_SIZE;
+  int idx = page_search(page, entry_cnt, key);
+  if (idx == -1) {
+    return nullptr;
+  }
+
+  // del flags sit at the end of the page.
+  uint64_t result;
+  std::memcpy(&result, page + page_bytes - BOOL_BYTE_CNT, BOOL_BYTE_CNT);
+  std::bitset<64> del_flag_bitset(result);
+
+  auto entry = std::make_unique<Entry_t>();
+  entry->key = key;
+  std::memcpy(&entry->val, page + idx * PAGE_ENTRY_SIZE + sizeof(KEY_t),
+              sizeof(VALUE_t));
+  entry->del = del_flag_bitset[63 - idx];
+  return entry;
+}
+
+// append every entry of the page with lower <= key <= upper to out, in key
+// order. Deleted entries are included with their del flag set.
+inline void page_collect_range(const char* page,
+                               size_t page_bytes,
+                               KEY_t lower,
+                               KEY_t upper,
+                               std::vector<Entry_t>& out) {
+  if (page_bytes <= BOOL_BYTE_CNT) {
+    return;
+  }
+  uint64_t result;
+  std::memcpy(&result, page + page_bytes - BOOL_BYTE_CNT, BOOL_BYTE_CNT);
+  std::bitset<64> del_flag_bitset(result);
+
+  int entry_cnt = (page_bytes - BOOL_BYTE_CNT) / PAGE_ENTRY_SIZE;
+  for (int idx = 0; idx < entry_cnt; idx++) {
+    Entry_t entry;
+    entry.key = page_key_at(page, idx);
+    if (entry.key < lower) {
+      continue;
+    }
+    if (entry.key > upper) {
+      break;
+    }
+    std::memcpy(&entry.val, page + idx * PAGE_ENTRY_SIZE + sizeof(KEY_t),
+                sizeof(VALUE_t));
+    entry.del = del_flag_bitset[63 - idx];
+    out.push_back(entry);
+  }
+}
+
+#endif
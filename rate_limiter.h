@@ -0,0 +1,49 @@
+// This class caps the bytes per second a background task may read or write,
+// so a large compaction cannot take all of the disk bandwidth from foreground
+// reads. It is a token bucket: callers pay for each transfer up front and
+// sleep when the bucket runs dry.
+#pragma once
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+class RateLimiter {
+  size_t bytes_per_sec;  // 0 means unlimited
+
+  std::mutex mutex;
+  double available = 0;  // bytes that may be used right now
+  std::chrono::steady_clock::time_point last_refill =
+      std::chrono::steady_clock::now();
+
+ public:
+  explicit RateLimiter(size_t bytes_per_sec) : bytes_per_sec(bytes_per_sec) {}
+
+  // block until bytes may be transferred. Bursts are capped at one second of
+  // budget; a request larger than that simply waits until it is paid for.
+  void request(size_t bytes) {
+    if (bytes_per_sec == 0) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    available += std::chrono::duration<double>(now - last_refill).count() *
+                 bytes_per_sec;
+    if (available > bytes_per_sec) {
+      available = bytes_per_sec;
+    }
+    last_refill = now;
+
+    available -= bytes;
+    if (available < 0) {
+      // sleep off the debt; later callers queue up behind it.
+      auto wait = std::chrono::duration<double>(-available / bytes_per_sec);
+      lock.unlock();
+      std::this_thread::sleep_for(wait);
+    }
+  }
+};
+
+#endif
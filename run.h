@@ -2,10 +2,13 @@
 #ifndef RUN_H
 #define RUN_H
 
+#include <memory>
 #include <vector>
 
 #include "key_value.h"
 #include "bloom.h"
+#include "page_search.h"
+#include "run_file.h"
 #include "lib/ThreadPool.h"
 
 class Run {
@@ -13,16 +16,21 @@ class Run {
     BloomFilter* bloom;
     std::vector<KEY_t>* fence_pointers;
     std::string file_location; // storage location of the stored binary file
+    std::shared_ptr<RunFile> file; // open handle shared by copies of this run
     int current_level; 
 
 public:
-    Run(std::string file_name, BloomFilter* bloom, std::vector<KEY_t>* fence);
+    Run(std::string file_name, BloomFilter* bloom, std::vector<KEY_t>* fence,
+        BlockCache* cache = nullptr);
+    // open an existing run, taking its filter and fences from the file footer.
+    Run(std::string file_name, BlockCache* cache = nullptr);
     Run();
 
     Run(const Run& other) {
         bloom = other.bloom; 
         fence_pointers = other.fence_pointers; 
         file_location = other.file_location;
+        file = other.file;
         current_level = other.current_level;
     };
 
@@ -30,12 +38,14 @@ public:
     bool search_bloom(KEY_t key);
     std::string get_file_location();
 
-    std::unique_ptr<Entry_t> disk_search(int starting_point, size_t bytes_to_read, KEY_t key);
-    std::vector<Entry_t> range_disk_search(KEY_t lower, KEY_t upper);
+    std::unique_ptr<Entry_t> disk_search(int starting_point, KEY_t key);
+    void multi_get(const std::vector<KEY_t>& keys,
+                   std::vector<std::unique_ptr<Entry_t>>& found);
     
     // return pointers to the underlying data structures
     std::vector<KEY_t> return_fence();
     BloomFilter return_bloom();
+    std::shared_ptr<RunFile> return_file(){return file;};
     void set_current_level(int lvl){current_level = lvl;};
     int return_current_level(){return current_level;};
 };
@@ -0,0 +1,339 @@
+// This class keeps the binary file behind a Run or a leveled block open for
+// the whole lifetime of the owner. The files are immutable once written, so
+// the file is mapped once and page reads become a memcpy out of the mapping.
+// If the file cannot be mapped the descriptor is kept and reads use pread.
+// Page reads go through the shared BlockCache when one is attached.
+//
+// A run file is laid out as
+//   [data pages][bloom filter words][fence pointers][page crcs]
+//   [page offsets, packed files only][RunFooter]
+// so the whole run, filter and fences included, lives in one file. The footer
+// has a fixed size and sits at the end; it gives the size of each region.
+// Raw pages are LOAD_MEMORY_PAGE_SIZE bytes apart. Packed pages (see
+// page_codec.h) vary in size, so their start offsets are stored; they are
+// decoded to raw pages as they are read.
+// Every page has a CRC32C that is checked whenever the page is read from
+// disk; a mismatch throws CorruptionError. Pages served from the block cache
+// were checked when they were loaded.
+#pragma once
+#ifndef RUN_FILE_H
+#define RUN_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "block_cache.h"
+#include "bloom.h"
+#include "crc32c.h"
+#include "key_value.h"
+#include "page_codec.h"
+
+struct RunFooter {
+  static const uint64_t MAGIC = 0x31304e5552534d4cULL;  // "LSMRUN01"
+
+  uint64_t data_size = 0;   // bytes of data pages at the start of the file
+  uint64_t entry_cnt = 0;
+  uint64_t bloom_bits = 0;  // 0 when the run was written without a filter
+  uint64_t fence_cnt = 0;
+  KEY_t min_key = 0;
+  KEY_t max_key = 0;
+  uint16_t bloom_type = BloomFilter::CLASSIC;
+  // probes per key of a BLOCKED filter; 0 in files written before it was
+  // stored, which probed DEFAULT_PROBE_CNT times.
+  uint16_t bloom_probes = 0;
+  uint32_t page_format = PAGE_RAW;
+  uint32_t meta_crc = 0;  // crc of everything between the pages and footer
+  uint16_t key_size = sizeof(KEY_t);
+  uint16_t value_size = sizeof(VALUE_t);
+  uint64_t magic = MAGIC;
+
+  static size_t bloom_words(uint64_t bits) { return (bits + 63) / 64; }
+
+  // a fence pointer per page plus the largest key.
+  size_t page_cnt() const { return fence_cnt > 0 ? fence_cnt - 1 : 0; }
+
+  // offset of the page crcs from the end of the data pages.
+  size_t crc_offset() const {
+    return bloom_words(bloom_bits) * sizeof(uint64_t) +
+           fence_cnt * sizeof(KEY_t);
+  }
+
+  // offset of the page offsets from the end of the data pages.
+  size_t offsets_offset() const {
+    return crc_offset() + page_cnt() * sizeof(uint32_t);
+  }
+
+  // bytes between the data pages and the footer.
+  size_t meta_size() const {
+    size_t offsets_size =
+        page_format == PAGE_PACKED ? (page_cnt() + 1) * sizeof(uint64_t) : 0;
+    return offsets_offset() + offsets_size;
+  }
+};
+
+// thrown when data read back from a run file fails its checksum.
+class CorruptionError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+class RunFile {
+  std::string file_location;
+  int fd = -1;
+  size_t file_size = 0;
+  size_t data_end = 0;  // end of the data pages
+  RunFooter footer;
+  bool has_footer = false;
+  std::vector<uint32_t> page_crcs;  // empty for files without a footer
+  std::vector<uint64_t> page_offsets;  // page starts and data end, if packed
+  char* data = nullptr;  // whole-file mapping, nullptr when using pread.
+
+  uint64_t file_id;     // unique per opened file, used as the cache key.
+  BlockCache* cache;    // shared page cache, may be nullptr.
+
+  static uint64_t next_file_id() {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+  }
+
+  // a file without a valid footer is read as data pages only.
+  void read_footer() {
+    data_end = file_size;
+    if (file_size < sizeof(RunFooter)) {
+      return;
+    }
+    RunFooter tail;
+    read(file_size - sizeof(RunFooter), reinterpret_cast<char*>(&tail),
+         sizeof(RunFooter));
+    if (tail.magic != RunFooter::MAGIC ||
+        tail.data_size + tail.meta_size() + sizeof(RunFooter) != file_size) {
+      return;
+    }
+    if (tail.key_size != sizeof(KEY_t) || tail.value_size != sizeof(VALUE_t)) {
+      throw std::runtime_error(file_location + " was written with " +
+                               std::to_string(tail.key_size) + " byte keys and " +
+                               std::to_string(tail.value_size) +
+                               " byte values");
+    }
+    footer = tail;
+    has_footer = true;
+    data_end = footer.data_size;
+
+    page_crcs.resize(footer.page_cnt());
+    read(data_end + footer.crc_offset(),
+         reinterpret_cast<char*>(page_crcs.data()),
+         page_crcs.size() * sizeof(uint32_t));
+    if (footer.page_format == PAGE_PACKED) {
+      page_offsets.resize(footer.page_cnt() + 1);
+      read(data_end + footer.offsets_offset(),
+           reinterpret_cast<char*>(page_offsets.data()),
+           page_offsets.size() * sizeof(uint64_t));
+    }
+  }
+
+ public:
+  explicit RunFile(const std::string& file_location,
+                   BlockCache* cache = nullptr)
+      : file_location(file_location), file_id(next_file_id()), cache(cache) {
+    fd = ::open(file_location.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open file for reading: " +
+                               file_location);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Failed to stat file: " + file_location);
+    }
+    file_size = st.st_size;
+
+    if (file_size > 0) {
+      void* mapped =
+          ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        data = static_cast<char*>(mapped);
+        // the mapping keeps the file alive, the descriptor is not needed.
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    read_footer();
+  }
+
+  ~RunFile() {
+    if (data) {
+      ::munmap(data, file_size);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  RunFile(const RunFile&) = delete;
+  RunFile& operator=(const RunFile&) = delete;
+
+  size_t size() const { return file_size; }
+
+  // the footer of the file, or nullptr if the file has none.
+  const RunFooter* get_footer() const {
+    return has_footer ? &footer : nullptr;
+  }
+
+  // read the bloom filter and fence pointers stored behind the data pages
+  // with a single read. Returns nullptr when the run has no filter; the
+  // caller owns the new filter.
+  BloomFilter* load_metadata(std::vector<KEY_t>& fence_pointers) const {
+    if (!has_footer) {
+      throw std::runtime_error("Run file has no footer");
+    }
+    std::vector<char> meta(footer.meta_size());
+    read(data_end, meta.data(), meta.size());
+    if (crc32c::value(meta.data(), meta.size()) != footer.meta_crc) {
+      throw CorruptionError("Corrupt bloom filter or fence pointers in " +
+                            file_location);
+    }
+
+    size_t word_cnt = RunFooter::bloom_words(footer.bloom_bits);
+    fence_pointers.resize(footer.fence_cnt);
+    std::memcpy(fence_pointers.data(),
+                meta.data() + word_cnt * sizeof(uint64_t),
+                footer.fence_cnt * sizeof(KEY_t));
+
+    if (footer.bloom_bits == 0) {
+      return nullptr;
+    }
+    std::vector<uint64_t> words(word_cnt);
+    std::memcpy(words.data(), meta.data(), word_cnt * sizeof(uint64_t));
+    int probes = footer.bloom_probes ? footer.bloom_probes
+                                     : BloomFilter::DEFAULT_PROBE_CNT;
+    return new BloomFilter(words, footer.bloom_bits,
+                           static_cast<BloomFilter::Type>(footer.bloom_type),
+                           probes);
+  }
+
+  // copy up to len bytes starting at offset into buf. Returns bytes copied.
+  size_t read(size_t offset, char* buf, size_t len) const {
+    if (offset >= file_size) {
+      return 0;
+    }
+    len = std::min(len, file_size - offset);
+
+    if (data) {
+      std::memcpy(buf, data + offset, len);
+      return len;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = ::pread(fd, buf + done, len - done, offset + done);
+      if (n <= 0) {
+        throw std::runtime_error("Failed to read from run file");
+      }
+      done += n;
+    }
+    return done;
+  }
+
+  int page_count() const {
+    if (has_footer) {
+      return footer.page_cnt();
+    }
+    return (data_end + LOAD_MEMORY_PAGE_SIZE - 1) / LOAD_MEMORY_PAGE_SIZE;
+  }
+
+  // where the given page starts; page_count() gives the end of the data.
+  size_t page_offset(int page) const {
+    if (!page_offsets.empty()) {
+      return page_offsets[page];
+    }
+    return std::min(static_cast<size_t>(page) * LOAD_MEMORY_PAGE_SIZE,
+                    data_end);
+  }
+
+  // bytes the given page takes on disk; the last raw page may be short.
+  size_t stored_size(int page) const {
+    if (page >= page_count()) {
+      return 0;
+    }
+    return page_offset(page + 1) - page_offset(page);
+  }
+
+  // hint that [offset, offset + len) is about to be read, so the kernel can
+  // start reading it in ahead of a sequential scan.
+  void prefetch(size_t offset, size_t len) const {
+    if (offset >= file_size) {
+      return;
+    }
+    len = std::min(len, file_size - offset);
+
+    if (data) {
+      // madvise needs a page aligned start address.
+      static const size_t os_page = ::sysconf(_SC_PAGESIZE);
+      size_t start = offset - offset % os_page;
+      ::madvise(data + start, len + (offset - start), MADV_WILLNEED);
+    } else {
+      ::posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+    }
+  }
+
+  // read one page into buf as a raw page of up to LOAD_MEMORY_PAGE_SIZE
+  // bytes and check it against its crc. Returns the page size, 0 past the
+  // last page.
+  size_t read_page(int page, char* buf) const {
+    size_t stored_bytes = stored_size(page);
+    if (stored_bytes > static_cast<size_t>(PACKED_PAGE_BUFFER) - 8) {
+      throw CorruptionError("Bad page size in page " + std::to_string(page) +
+                            " of " + file_location);
+    }
+    char stored[PACKED_PAGE_BUFFER];
+    char* target = page_offsets.empty() ? buf : stored;
+    read(page_offset(page), target, stored_bytes);
+    std::memset(stored + stored_bytes, 0, 8);  // slack read by the unpacker
+    if (static_cast<size_t>(page) < page_crcs.size() &&
+        crc32c::value(target, stored_bytes) != page_crcs[page]) {
+      throw CorruptionError("Checksum mismatch in page " +
+                            std::to_string(page) + " of " + file_location);
+    }
+    if (page_offsets.empty()) {
+      return stored_bytes;
+    }
+
+    size_t page_bytes = page_unpack(stored, stored_bytes, buf);
+    if (page_bytes == 0) {
+      throw CorruptionError("Undecodable page " + std::to_string(page) +
+                            " of " + file_location);
+    }
+    return page_bytes;
+  }
+
+  // return one page, from the block cache when possible.
+  std::shared_ptr<const CachedPage> load_page(int page) const {
+    if (cache) {
+      auto cached = cache->lookup(file_id, page);
+      if (cached) {
+        return cached;
+      }
+    }
+
+    auto loaded = std::make_shared<CachedPage>();
+    loaded->size = read_page(page, loaded->data);
+
+    if (cache && loaded->size > 0) {
+      cache->insert(file_id, page, loaded);
+    }
+    return loaded;
+  }
+};
+
+#endif
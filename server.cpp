@@ -1,21 +1,35 @@
 // g++ -std=c++17 -I /Users/hongkaiwang/opt/boost_1_67_0 -g lsm_tree.cpp
-// level_run.cpp bloom.cpp server.cpp run.cpp -w -o server
+// level_run.cpp bloom.cpp server.cpp run.cpp string_tree.cpp -w -o server
 #include <string>
 #include "lib/httplib.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <filesystem>
 #include <iostream>
 #include <mutex>
+#include <shared_mutex>
 #include <sstream>
 
 #include "buffer_level.h"
 #include "lsm_tree.h"
 #include "run.h"
 #include "task_queue.h"
+#include "write_batch.h"
 
 namespace fs = std::filesystem;
 
-std::mutex tree_mutex; // Global mutex for LSM_Tree access
+// Reader-writer lock for LSM_Tree access. LSM_Tree synchronizes its own
+// reads and writes, and a load or batch becomes visible all at once, so every
+// command shares the lock and runs concurrently on the workers. Only shutdown
+// takes it exclusively, so the tree is saved once nothing else is running.
+std::shared_mutex tree_mutex;
+
+// number of worker threads executing client commands.
+const int num_workers = 8;
+
+// longest a /status long poll may block, in milliseconds.
+const int max_status_wait_ms = 30000;
 
 std::string http_command_process(LSM_Tree *tree, std::string input)
 {
@@ -28,6 +42,18 @@ std::string http_command_process(LSM_Tree *tree, std::string input)
 
   ss >> command;
 
+  std::shared_lock<std::shared_mutex> shared_lock(tree_mutex, std::defer_lock);
+  std::unique_lock<std::shared_mutex> exclusive_lock(tree_mutex,
+                                                     std::defer_lock);
+  if (command == "q")
+  {
+    exclusive_lock.lock();
+  }
+  else if (command != "cq")
+  {
+    shared_lock.lock();
+  }
+
   if (command == "q")
   {
     tree->exit_save();
@@ -66,6 +92,29 @@ std::string http_command_process(LSM_Tree *tree, std::string input)
         return_msg = "Key not found!";
       }
     }
+    else if (command == "m")
+    { // get a batch of keys: m key1 key2 ...
+      std::vector<KEY_t> keys;
+      while (ss >> key_a)
+      {
+        keys.push_back(key_a);
+      }
+
+      auto entries = tree->multi_get(keys);
+      std::stringstream oss;
+      for (size_t i = 0; i < keys.size(); i++)
+      {
+        if (entries[i] && !entries[i]->del)
+        {
+          oss << *entries[i] << " found!" << std::endl;
+        }
+        else
+        {
+          oss << "Key " << keys[i] << " not found!" << std::endl;
+        }
+      }
+      return_msg = oss.str();
+    }
     else if (command == "r")
     { // range
       ss >> key_a >> key_b;
@@ -88,6 +137,29 @@ std::string http_command_process(LSM_Tree *tree, std::string input)
       }
       return_msg = oss.str();
     }
+    else if (command == "b")
+    { // batch of writes applied together: b p key val d key ...
+      WriteBatch batch;
+      std::string op;
+      while (ss >> op)
+      {
+        if (op == "p" && ss >> key_a >> val)
+        {
+          batch.put(key_a, val);
+        }
+        else if (op == "d" && ss >> key_a)
+        {
+          batch.del(key_a);
+        }
+        else
+        {
+          throw std::runtime_error("Invalid batch operation: " + op);
+        }
+      }
+      tree->write(batch);
+      return_msg =
+          "Batch of " + std::to_string(batch.size()) + " writes applied!";
+    }
     else if (command == "d")
     { // delete
       ss >> key_a;
@@ -99,44 +171,61 @@ std::string http_command_process(LSM_Tree *tree, std::string input)
       std::string file_path;
 
       ss >> file_path;
-      std::ifstream file(file_path, std::ios::binary);
-
-      if (!file)
+      // sorted into runs directly instead of one put per pair.
+      tree->bulk_load(file_path);
+      return_msg = "file loaded";
+    }
+    else if (command == "P")
+    { // string put: P key val
+      std::string key, value;
+      ss >> key >> value;
+      tree->strings()->put(key, value);
+      return_msg = "Key-value set!";
+    }
+    else if (command == "G")
+    { // string get
+      std::string key;
+      ss >> key;
+      auto value = tree->strings()->get(key);
+      if (value && !value->del)
       {
-        throw std::runtime_error("Cannot open file: " + file_path);
+        std::stringstream oss;
+        oss << *value << " found!";
+        return_msg = oss.str();
       }
-
-      file.seekg(0, std::ios::end);
-      size_t file_size = file.tellg();
-      file.seekg(0, std::ios::beg);
-
-      std::vector<char> file_data(file_size);
-      if (!file.read(file_data.data(), file_size))
+      else
       {
-        std::cerr << "Error reading file.\n";
+        return_msg = "Key not found!";
       }
-      // read in the run's information.
-      int idx = 0;
-      while (file_size > 0)
+    }
+    else if (command == "D")
+    { // string delete
+      std::string key;
+      ss >> key;
+      tree->strings()->del(key);
+      return_msg = "Key deleted";
+    }
+    else if (command == "R")
+    { // string range: R lower upper
+      std::string lower, upper;
+      ss >> lower >> upper;
+      std::stringstream oss;
+      for (const auto &entry : tree->strings()->range(lower, upper))
       {
-        Entry_t entry;
-        std::memcpy(&entry.key, &file_data[idx], sizeof(KEY_t));
-        idx += sizeof(KEY_t);
-        std::memcpy(&entry.val, &file_data[idx], sizeof(VALUE_t));
-        idx += sizeof(VALUE_t);
-
-        tree->put(entry.key, entry.val);
-        file_size = file_size - (sizeof(VALUE_t) + sizeof(KEY_t));
+        oss << entry.key << ":" << entry.val << std::endl;
       }
-
-      file.close();
-      return_msg = "file loaded";
+      return_msg = oss.str();
     }
     else if (command == "s")
     { // print structure
       return_msg = tree->print();
     }
   }
+  catch (const CorruptionError &e)
+  {
+    return_msg = std::string("Corrupt data: ") + e.what();
+    return return_msg;
+  }
   catch (const std::exception &e)
   {
     return_msg = "Invalid command. Try again!";
@@ -145,38 +234,38 @@ std::string http_command_process(LSM_Tree *tree, std::string input)
 
   return return_msg;
 }
+// body of each worker thread. Sleeps until a task is queued and exits once
+// the queue is shut down.
 void taskProcessor(LSM_Tree *tree,
                    MyTaskQueue &taskQueue,
-                   std::map<std::string, std::string> &results)
+                   std::map<std::string, std::string> &results,
+                   std::mutex &results_mutex,
+                   std::condition_variable &results_cv)
 {
-  std::mutex results_mutex;
-  while (true)
+  Task task;
+  while (taskQueue.wait_pop(task))
   {
-    Task task;
-    if (taskQueue.pop(task))
-    {
-      std::cout << "Processing task with data: " << task.data << std::endl;
-      auto start = std::chrono::high_resolution_clock::now();
-      std::string ret = http_command_process(tree, task.data);
-      results_mutex.lock();
-      results[task.id] = ret;
-      results_mutex.unlock();
-
-      auto end = std::chrono::high_resolution_clock::now();
-      auto duration =
-          std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      std::cout << duration.count() << " milliseconds." << std::endl;
-    }
-    else
-    {
-      std::this_thread::sleep_for(std::chrono::milliseconds(
-          100)); // Sleep briefly if no task is available
-    }
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string ret = http_command_process(tree, task.data);
+    results_mutex.lock();
+    results[task.id] = ret;
+    results_mutex.unlock();
+    results_cv.notify_all(); // wake /status long polls.
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    // one write per task so lines from different workers don't interleave.
+    std::ostringstream log;
+    log << "Processed task with data: " << task.data << " in "
+        << duration.count() << " milliseconds.\n";
+    std::cout << log.str() << std::flush;
   }
 }
 std::string generate_unique_id()
 {
-  unsigned long long counter;
+  // shared by the http handler threads.
+  static std::atomic<unsigned long long> counter{0};
   std::string base;
   auto now = std::chrono::system_clock::now();
   auto duration = now.time_since_epoch();
@@ -189,7 +278,7 @@ std::string generate_unique_id()
 
   return ss.str();
 }
-int main()
+int main(int argc, char *argv[])
 {
   using namespace httplib;
 
@@ -201,11 +290,34 @@ int main()
   MyTaskQueue taskQueue;
   std::map<std::string, std::string> results;
   std::mutex results_mutex;
+  std::condition_variable results_cv;
+
+  // an existing tree is opened with the configuration in its manifest, so
+  // its levels are read back the way they were written.
+  LSM_Options options = parse_options(argc, argv);
+  LSM_Tree *lsm_tree = Manifest::exists()
+                           ? meta_load_save(options)
+                           : new LSM_Tree(0.0001, 10, 10000, 0, 8, 0, 16384,
+                                          options);
+  lsm_tree->recover_manifest();
+  lsm_tree->recover_wal();
+
+  // synchronous endpoint: runs the command on the http thread and returns its
+  // result in the response, so a client needs one round trip and no polling.
+  svr.Post("/command", [&](const Request &req, Response &res)
+           {
+    if (req.body.empty()) {
+      res.set_content("Received empty data", "text/plain");
+      return;
+    }
+    std::string ret = http_command_process(lsm_tree, req.body);
+    res.set_content(ret, "text/plain");
+    if (ret == "shutdown") {
+      svr.stop();  // Stop the server
+    } });
 
-  // Add in load data meta data files.
-  LSM_Tree *lsm_tree = new LSM_Tree(0.0001, 10, 10000, 0, 8, 0);
-
-  // POST endpoint
+  // asynchronous endpoint: queues the command and returns a task id to pass
+  // to /status. Kept for long running commands such as loads.
   svr.Post("/post", [&](const Request &req, Response &res)
            {
     std::string command = req.body;  // Command is received in the body
@@ -223,36 +335,70 @@ int main()
       task.id = task_id;
       task.data = command;
 
-      taskQueue.push(task);
-      taskQueue.printAndRestore();
-
+      // mark the task before queueing it; a worker may finish it before
+      // this handler gets to run again.
       results_mutex.lock();
       results[task_id] = "Processing";
       results_mutex.unlock();
 
+      taskQueue.push(task);
+      taskQueue.printAndRestore();
+
       res.set_content(task_id, "text/plain");
     } });
 
   svr.Get("/status", [&](const Request &req, Response &res)
           {
     auto id = req.get_param_value("id");
-    std::lock_guard<std::mutex> lock(results_mutex);
-    if (results.find(id) != results.end()) {
-      res.set_content(results[id], "text/plain");
-      results.erase(
-          id);  // remove the info from results to keep memory overhead low.
+    // with wait=<ms> the request blocks until the task finishes or the wait
+    // runs out, instead of returning "Processing" right away.
+    int wait_ms = 0;
+    if (req.has_param("wait")) {
+      try {
+        wait_ms = std::stoi(req.get_param_value("wait"));
+      } catch (const std::exception &e) {
+        wait_ms = 0;
+      }
+      wait_ms = std::max(0, std::min(wait_ms, max_status_wait_ms));
+    }
+
+    std::unique_lock<std::mutex> lock(results_mutex);
+    results_cv.wait_for(lock, std::chrono::milliseconds(wait_ms), [&]() {
+      auto it = results.find(id);
+      return it == results.end() || it->second != "Processing";
+    });
+    auto it = results.find(id);
+    if (it != results.end()) {
+      res.set_content(it->second, "text/plain");
+      if (it->second != "Processing") {
+        results.erase(
+            it);  // remove the info from results to keep memory overhead low.
+      }
     } else {
       res.set_content("Task ID not found", "text/plain");
     } });
 
-  // Start the task processor thread
-  std::thread worker(
-      [&]()
-      { taskProcessor(lsm_tree, std::ref(taskQueue), results); });
-  worker.detach();
+  // Start the task processor threads
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_workers; i++)
+  {
+    workers.emplace_back(
+        [&]()
+        {
+          taskProcessor(
+              lsm_tree, taskQueue, results, results_mutex, results_cv);
+        });
+  }
 
   svr.listen("127.0.0.1", 8080);
 
+  // finish the queued tasks before the tree goes away.
+  taskQueue.shutdown();
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+
   delete lsm_tree;
 
   return 0;
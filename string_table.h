@@ -0,0 +1,378 @@
+// On-disk tables for string keys and values, the variable-length
+// counterpart of the run files in run_file.h. A table is laid out as
+//   [data block][data block]...[index block][bloom filter words]
+//   [StringTableFooter]
+// Data blocks hold prefix-compressed records (see block_format.h) and are
+// cut once they reach TARGET_BLOCK_SIZE bytes. The index block replaces the
+// fence pointers: it is itself a block with one record per data block, whose
+// key is the last key of that block and whose value is the block's
+// [varint offset][varint size][fixed32 crc32c]. A lookup checks the bloom
+// filter, seeks the index for the first block whose last key is >= the key
+// and then seeks inside that one block.
+#pragma once
+#ifndef STRING_TABLE_H
+#define STRING_TABLE_H
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "block_format.h"
+#include "bloom.h"
+#include "crc32c.h"
+#include "key_value.h"
+#include "rate_limiter.h"
+#include "run_file.h"
+
+struct StringTableFooter {
+  static const uint64_t MAGIC = 0x32305453534d534cULL;  // "LSMSST02"
+
+  uint64_t data_size = 0;   // bytes of data blocks at the start of the file
+  uint64_t index_size = 0;
+  uint64_t entry_cnt = 0;
+  uint64_t bloom_bits = 0;
+  uint16_t bloom_type = BloomFilter::BLOCKED;
+  uint16_t bloom_probes = 0;  // 0 in tables from before it was stored: 3
+  uint32_t meta_crc = 0;  // crc of the index block and the bloom words
+  uint64_t magic = MAGIC;
+
+  size_t bloom_size() const { return (bloom_bits + 63) / 64 * sizeof(uint64_t); }
+};
+
+/**
+ * StringTableWriter
+ * Writes sorted string entries as a string table. Keys must arrive in
+ * strictly increasing order, as a merge produces them.
+ */
+class StringTableWriter {
+ public:
+  static const size_t TARGET_BLOCK_SIZE = 4096;
+
+ private:
+  std::ofstream out;
+  BloomFilter bloom;
+  RateLimiter* limiter;  // charged for every block written, may be nullptr
+
+  BlockBuilder data_block;
+  BlockBuilder index_block{1};  // index keys are read whole, no prefixes
+  std::string last_key;
+  size_t data_bytes = 0;
+  size_t total = 0;
+
+  void write_block() {
+    std::string block = data_block.finish();
+    if (limiter) {
+      limiter->request(block.size());
+    }
+    std::string handle;
+    block_format::put_varint(handle, data_bytes);
+    block_format::put_varint(handle, block.size());
+    block_format::put_fixed32(handle, crc32c::value(block.data(), block.size()));
+    index_block.add(last_key, handle, false);
+
+    out.write(block.data(), block.size());
+    data_bytes += block.size();
+  }
+
+ public:
+  // the filter gets bits_per_key bits for each of the expected entries.
+  StringTableWriter(const std::string& filename,
+                    size_t expected_entries,
+                    float bits_per_key,
+                    RateLimiter* limiter = nullptr)
+      : out(filename, std::ios::binary),
+        bloom(std::max<long>(expected_entries * bits_per_key, 64),
+              BloomFilter::BLOCKED, BloomFilter::probes_for(bits_per_key)),
+        limiter(limiter) {
+    if (!out.is_open()) {
+      throw std::runtime_error("Unable to open file for writing");
+    }
+  }
+
+  void add(const StringEntry& entry) {
+    bloom.set(entry.key);
+    data_block.add(entry.key, entry.val, entry.del, entry.indirect);
+    last_key = entry.key;
+    total++;
+    if (data_block.size_estimate() >= TARGET_BLOCK_SIZE) {
+      write_block();
+    }
+  }
+
+  size_t count() const { return total; }
+
+  // write the last block, the index block, the filter and the footer, and
+  // close the file.
+  void finish() {
+    if (!data_block.empty()) {
+      write_block();
+    }
+
+    StringTableFooter footer;
+    footer.data_size = data_bytes;
+    footer.entry_cnt = total;
+    std::string meta = index_block.finish();
+    footer.index_size = meta.size();
+    std::vector<uint64_t> words = bloom.to_words();
+    meta.append(reinterpret_cast<const char*>(words.data()),
+                words.size() * sizeof(uint64_t));
+    footer.bloom_bits = bloom.return_bitarray_size();
+    footer.bloom_type = bloom.return_type();
+    footer.bloom_probes = bloom.return_probe_cnt();
+    footer.meta_crc = crc32c::value(meta.data(), meta.size());
+
+    out.write(meta.data(), meta.size());
+    out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Failed to write string table");
+    }
+  }
+};
+
+/**
+ * StringTable
+ * An open string table. The file stays mapped through a RunFile, and the
+ * index block and bloom filter are held in memory.
+ */
+class StringTable {
+  std::string file_location;
+  std::shared_ptr<RunFile> file;
+  StringTableFooter footer;
+  std::shared_ptr<const std::string> index;
+  std::unique_ptr<BloomFilter> bloom;
+
+  // read the data block an index record points to and check its crc.
+  BlockIterator read_block(const std::string& handle) const {
+    const char* p = handle.data();
+    const char* limit = p + handle.size();
+    uint64_t offset, size;
+    p = block_format::get_varint(p, limit, &offset);
+    if (p) p = block_format::get_varint(p, limit, &size);
+    if (!p || limit - p != sizeof(uint32_t) ||
+        offset + size > footer.data_size) {
+      throw CorruptionError("Bad block handle in " + file_location);
+    }
+    auto block = std::make_shared<std::string>(size, '\0');
+    file->read(offset, &(*block)[0], size);
+    if (crc32c::value(block->data(), size) != block_format::get_fixed32(p)) {
+      throw CorruptionError("Checksum mismatch in block at " +
+                            std::to_string(offset) + " of " + file_location);
+    }
+    return BlockIterator(block);
+  }
+
+ public:
+  explicit StringTable(const std::string& file_name)
+      : file_location(file_name),
+        file(std::make_shared<RunFile>(file_name)) {
+    if (file->size() < sizeof(StringTableFooter)) {
+      throw CorruptionError("Truncated string table " + file_location);
+    }
+    file->read(file->size() - sizeof(StringTableFooter),
+               reinterpret_cast<char*>(&footer), sizeof(footer));
+    size_t meta_size = footer.index_size + footer.bloom_size();
+    if (footer.magic != StringTableFooter::MAGIC ||
+        footer.data_size + meta_size + sizeof(footer) != file->size()) {
+      throw CorruptionError("Bad footer in string table " + file_location);
+    }
+
+    std::string meta(meta_size, '\0');
+    file->read(footer.data_size, &meta[0], meta_size);
+    if (crc32c::value(meta.data(), meta.size()) != footer.meta_crc) {
+      throw CorruptionError("Corrupt index or bloom filter in " +
+                            file_location);
+    }
+    index = std::make_shared<const std::string>(meta, 0, footer.index_size);
+    std::vector<uint64_t> words(footer.bloom_size() / sizeof(uint64_t));
+    std::memcpy(words.data(), meta.data() + footer.index_size,
+                footer.bloom_size());
+    bloom = std::make_unique<BloomFilter>(
+        words, footer.bloom_bits,
+        static_cast<BloomFilter::Type>(footer.bloom_type),
+        footer.bloom_probes ? footer.bloom_probes
+                            : BloomFilter::DEFAULT_PROBE_CNT);
+  }
+
+  const std::string& get_file_location() const { return file_location; }
+  size_t entry_count() const { return footer.entry_cnt; }
+
+  // the entry stored for key, deleted or not, or nullptr.
+  std::unique_ptr<StringEntry> get(const std::string& key) const {
+    if (!bloom->is_set(key)) {
+      return nullptr;
+    }
+    BlockIterator index_it(index);
+    index_it.seek(key);
+    if (!index_it.valid()) {
+      return nullptr;  // larger than every key of the table.
+    }
+    BlockIterator block_it = read_block(index_it.value());
+    block_it.seek(key);
+    if (!block_it.valid() || block_it.key() != key) {
+      return nullptr;
+    }
+    return std::unique_ptr<StringEntry>(
+        new StringEntry{block_it.key(), block_it.value(), block_it.deleted(),
+                        block_it.indirect()});
+  }
+
+  // walks the entries of the table in key order, one block at a time.
+  class Iterator {
+    const StringTable* table;
+    BlockIterator index_it;
+    BlockIterator block_it;
+
+    // move to the first entry of the next non-empty block, if any.
+    void skip_finished_blocks() {
+      while (!block_it.valid() && index_it.valid()) {
+        index_it.next();
+        if (!index_it.valid()) {
+          return;
+        }
+        block_it = table->read_block(index_it.value());
+        block_it.seek_to_first();
+      }
+    }
+
+   public:
+    explicit Iterator(const StringTable* table)
+        : table(table), index_it(table->index) {}
+
+    void seek(const std::string& key) {
+      index_it.seek(key);
+      block_it = BlockIterator();
+      if (index_it.valid()) {
+        block_it = table->read_block(index_it.value());
+        block_it.seek(key);
+        skip_finished_blocks();
+      }
+    }
+
+    void seek_to_first() { seek(std::string()); }
+
+    bool valid() const { return block_it.valid(); }
+    const std::string& key() const { return block_it.key(); }
+    const std::string& value() const { return block_it.value(); }
+    bool deleted() const { return block_it.deleted(); }
+    bool indirect() const { return block_it.indirect(); }
+
+    void next() {
+      block_it.next();
+      skip_finished_blocks();
+    }
+  };
+};
+
+// A sorted input to a string merge: a memtable snapshot or one table.
+class StringSource {
+  const std::vector<StringEntry>* vec = nullptr;
+  size_t pos = 0;
+  std::unique_ptr<StringTable::Iterator> table_it;
+  StringEntry current;
+
+  void load_current() {
+    if (table_it && table_it->valid()) {
+      current = {table_it->key(), table_it->value(), table_it->deleted(),
+                 table_it->indirect()};
+    }
+  }
+
+ public:
+  explicit StringSource(const std::vector<StringEntry>& entries)
+      : vec(&entries) {}
+
+  explicit StringSource(const StringTable* table)
+      : table_it(std::make_unique<StringTable::Iterator>(table)) {}
+
+  void seek(const std::string& key) {
+    if (vec) {
+      pos = std::lower_bound(vec->begin(), vec->end(),
+                             StringEntry{key, "", false}) -
+            vec->begin();
+      return;
+    }
+    table_it->seek(key);
+    load_current();
+  }
+
+  bool valid() const { return vec ? pos < vec->size() : table_it->valid(); }
+
+  const StringEntry& entry() const { return vec ? (*vec)[pos] : current; }
+
+  void next() {
+    if (vec) {
+      pos++;
+      return;
+    }
+    table_it->next();
+    load_current();
+  }
+};
+
+/**
+ * StringMergingIterator
+ * The string counterpart of MergingIterator: sources[0] is the newest, and
+ * only the newest version of each key is visible, deleted or not. A merge
+ * that drops the older versions can watch them go by through on_shadowed.
+ */
+class StringMergingIterator {
+  typedef std::pair<std::string, size_t> HeapItem;
+
+  std::vector<StringSource> sources;
+  std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>>
+      heap;
+  std::function<void(const StringEntry&)> on_shadowed;
+
+ public:
+  explicit StringMergingIterator(std::vector<StringSource> merge_sources)
+      : sources(std::move(merge_sources)) {
+    seek(std::string());
+  }
+
+  // position at the first key >= key.
+  void seek(const std::string& key) {
+    heap = decltype(heap)();
+    for (size_t i = 0; i < sources.size(); i++) {
+      sources[i].seek(key);
+      if (sources[i].valid()) {
+        heap.push({sources[i].entry().key, i});
+      }
+    }
+  }
+
+  bool valid() const { return !heap.empty(); }
+
+  const StringEntry& entry() const {
+    return sources[heap.top().second].entry();
+  }
+
+  void set_shadowed_callback(std::function<void(const StringEntry&)> fn) {
+    on_shadowed = std::move(fn);
+  }
+
+  // move past the current key, skipping its older versions.
+  void next() {
+    std::string key = heap.top().first;
+    bool newest = true;
+    while (!heap.empty() && heap.top().first == key) {
+      size_t idx = heap.top().second;
+      heap.pop();
+      if (!newest && on_shadowed) {
+        on_shadowed(sources[idx].entry());
+      }
+      newest = false;
+      sources[idx].next();
+      if (sources[idx].valid()) {
+        heap.push({sources[idx].entry().key, idx});
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,730 @@
+#include "string_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+StringTree::StringTree(float bits_ratio,
+                       size_t level_ratio,
+                       size_t memtable_bytes,
+                       ThreadPool* pool,
+                       RateLimiter* compaction_limiter,
+                       WriteAheadLog::SyncMode wal_sync_mode,
+                       int wal_group_commit_ms,
+                       size_t wal_group_commit_entries)
+    : bloom_bits_per_entry(bits_ratio),
+      level_ratio(std::max<size_t>(level_ratio, 2)),
+      memtable_bytes(memtable_bytes),
+      pool(pool),
+      compaction_limiter(compaction_limiter),
+      memtable(std::make_shared<MemTable>()),
+      levels(1),
+      wal_sync_mode(wal_sync_mode),
+      wal_group_commit_ms(wal_group_commit_ms),
+      wal_group_commit_entries(wal_group_commit_entries),
+      vlog(value_log_segment_bytes) {}
+
+StringTree::~StringTree() {
+  {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    stop_flush = true;
+  }
+  flush_cv.notify_all();
+  room_cv.notify_all();
+  {
+    std::lock_guard<std::mutex> lock(gc_mutex);
+    stop_gc = true;
+  }
+  gc_cv.notify_all();
+  if (gc_thread.joinable()) {
+    gc_thread.join();
+  }
+  // memtables it did not get to are replayed from their logs next time.
+  if (flush_thread.joinable()) {
+    flush_thread.join();
+  }
+}
+
+/**
+ * StringTree recover
+ * Replays the manifest to reopen the tables, deletes table files it does not
+ * name, replays the memtable logs, reopens the value log without the
+ * segments nothing points to, and starts a new manifest from a snapshot.
+ */
+void StringTree::recover() {
+  // the edits are applied to file names first; tables removed by a later
+  // edit may already be gone from disk.
+  std::vector<std::vector<std::string>> names(1);
+  std::map<uint64_t, uint64_t> dead_bytes;
+  std::set<uint64_t> vlog_refs;
+  bool vlog_tracked = false;
+  for (const auto& record : Manifest::read_records(manifest_name())) {
+    std::istringstream lines(record);
+    std::string line;
+    while (std::getline(lines, line)) {
+      std::istringstream iss(line);
+      std::string op, filename;
+      size_t level;
+      if (!(iss >> op) || op == "config" || op == "add_level") {
+        continue;
+      }
+      if (op == "vlog_dead") {
+        uint64_t seq, bytes;
+        if (iss >> seq >> bytes) {
+          dead_bytes[seq] = bytes;
+        }
+        continue;
+      }
+      if (op == "vlog_tracked") {
+        vlog_tracked = true;
+        continue;
+      }
+      if (op == "vlog_ref" || op == "vlog_drop") {
+        uint64_t seq;
+        if (iss >> seq) {
+          if (op == "vlog_ref") {
+            vlog_refs.insert(seq);
+          } else {
+            vlog_refs.erase(seq);
+          }
+        }
+        continue;
+      }
+      if (!(iss >> level >> filename)) {
+        std::cerr << "Bad manifest edit: " << line << std::endl;
+        continue;
+      }
+      if (names.size() <= level) {
+        names.resize(level + 1);
+      }
+      auto& tables = names[level];
+      if (op == "add_run") {
+        tables.push_back(filename);
+      } else if (op == "remove_run") {
+        tables.erase(std::remove(tables.begin(), tables.end(), filename),
+                     tables.end());
+      }
+    }
+  }
+  levels.assign(names.size(), {});
+  for (size_t level = 0; level < names.size(); level++) {
+    for (auto& filename : names[level]) {
+      levels[level].push_back(std::make_shared<StringTable>(filename));
+    }
+  }
+  remove_orphan_files();
+  replay_logs();
+
+  // a manifest from before the segments were tracked names none of them.
+  if (vlog_tracked) {
+    for (auto& kv : memtable->entries) {
+      if (kv.second.indirect) {
+        vlog_refs.insert(ValueLog::segment_of(kv.second.val));
+      }
+    }
+    vlog.recover(&vlog_refs);
+  } else {
+    vlog.recover();
+  }
+  for (auto& seg : dead_bytes) {
+    vlog.set_dead_bytes(seg.first, seg.second);
+  }
+
+  manifest = std::make_unique<Manifest>(manifest_name());
+  manifest_snapshot();
+
+  uint64_t log_seq =
+      memtable->log_seqs.empty() ? 1 : memtable->log_seqs.back() + 1;
+  wal = std::make_unique<WriteAheadLog>(wal_sync_mode, wal_group_commit_ms,
+                                        wal_group_commit_entries, WAL_PREFIX);
+  wal->open(log_seq);
+  memtable->log_seqs.push_back(log_seq);
+  flush_thread = std::thread(&StringTree::flush_loop, this);
+  gc_thread = std::thread(&StringTree::gc_loop, this);
+
+  std::unique_lock<std::shared_mutex> lock(tree_mutex);
+  if (memtable->size >= memtable_bytes) {
+    seal_memtable(lock);
+  }
+}
+
+// delete table files no level refers to, and pick the next table id.
+void StringTree::remove_orphan_files() {
+  std::set<std::string> live;
+  for (auto& tables : levels) {
+    for (auto& table : tables) {
+      live.insert(table->get_file_location());
+    }
+  }
+
+  const std::string prefix = "lsm_tree_str_";
+  std::vector<std::filesystem::path> orphans;
+  for (const auto& file : std::filesystem::directory_iterator("./")) {
+    std::string name = file.path().filename().string();
+    if (name.rfind(prefix, 0) != 0 || file.path().extension() != ".sst") {
+      continue;
+    }
+    next_table_id =
+        std::max<uint64_t>(next_table_id,
+                           std::stoull(name.substr(prefix.size())) + 1);
+    if (!live.count(name)) {
+      orphans.push_back(file.path());
+    }
+  }
+  for (auto& path : orphans) {
+    std::filesystem::remove(path);
+  }
+}
+
+// replay the log segments of an earlier process, oldest first, into one
+// memtable that keeps them until it is flushed.
+void StringTree::replay_logs() {
+  for (uint64_t seq : WriteAheadLog::existing_segments(WAL_PREFIX)) {
+    memtable->log_seqs.push_back(seq);
+    replay_log(seq);
+  }
+}
+
+void StringTree::replay_log(uint64_t seq) {
+  for (auto& record : WriteAheadLog::read_raw_segment(seq, WAL_PREFIX)) {
+    const char* p = record.data();
+    const char* limit = p + record.size();
+
+    uint64_t key_len, val_tag;
+    p = block_format::get_varint(p, limit, &key_len);
+    if (!p || static_cast<uint64_t>(limit - p) < key_len) {
+      break;
+    }
+    std::string key(p, key_len);
+    p = block_format::get_varint(p + key_len, limit, &val_tag);
+    if (!p || static_cast<uint64_t>(limit - p) != (val_tag >> 2)) {
+      break;
+    }
+    // the overwrites were counted as garbage before the restart, and their
+    // counts may already be in the manifest.
+    upsert({key, std::string(p, val_tag >> 2), (val_tag & 1) != 0,
+            (val_tag & 2) != 0},
+           false);
+  }
+}
+
+// add a write to the log and return its number for WriteAheadLog::commit.
+// The caller holds the tree lock exclusively.
+uint64_t StringTree::append_log(const StringEntry& entry) {
+  std::string record;
+  block_format::put_varint(record, entry.key.size());
+  record.append(entry.key);
+  block_format::put_varint(record, (entry.val.size() << 2) |
+                                       (entry.indirect << 1) | entry.del);
+  record.append(entry.val);
+  return wal->append(record);
+}
+
+// insert or overwrite the memtable entry of a key. An overwritten value
+// pointer is counted as garbage unless count_garbage is false.
+void StringTree::upsert(const StringEntry& entry, bool count_garbage) {
+  auto it = memtable->entries.find(entry.key);
+  if (it != memtable->entries.end()) {
+    if (it->second.indirect && count_garbage) {
+      vlog.discard(it->second.val);
+    }
+    memtable->size -= it->second.val.size();
+    it->second = entry;
+  } else {
+    memtable->size += entry.key.size();
+    memtable->entries.emplace(entry.key, entry);
+  }
+  memtable->size += entry.val.size();
+}
+
+// log and insert a write, then wait for the log outside the lock so that
+// concurrent writers share a sync.
+void StringTree::apply(const StringEntry& entry) {
+  uint64_t lsn;
+  {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    lsn = append_log(entry);
+    upsert(entry);
+    if (memtable->size >= memtable_bytes) {
+      seal_memtable(lock);
+    }
+  }
+  wal->commit(lsn);
+}
+
+// hand the full memtable to the flush thread and start a new one. Waits
+// while MAX_IMMUTABLES memtables are still waiting for it, so the writers
+// cannot outrun the flushes. The caller holds the tree lock exclusively.
+void StringTree::seal_memtable(std::unique_lock<std::shared_mutex>& lock) {
+  room_cv.wait(lock, [this] {
+    return stop_flush || immutables.size() < MAX_IMMUTABLES;
+  });
+  if (memtable->size < memtable_bytes) {
+    return;  // another writer sealed it while this one waited.
+  }
+  uint64_t closed = wal->rotate();
+  immutables.push_back(memtable);
+  memtable = std::make_shared<MemTable>();
+  memtable->log_seqs.push_back(closed + 1);
+  flush_cv.notify_one();
+}
+
+void StringTree::put(const std::string& key, const std::string& val) {
+  apply({key, val, false});
+}
+
+void StringTree::del(const std::string& key) { apply({key, "", true}); }
+
+/**
+ * StringTree get
+ * Looks in the memtable and the sealed memtables, then every level top to bottom, newest table first,
+ * and reads the value from the value log if the entry points there.
+ */
+std::unique_ptr<StringEntry> StringTree::get(const std::string& key) {
+  std::shared_lock<std::shared_mutex> lock(tree_mutex);
+  std::unique_ptr<StringEntry> found = lookup(key);
+  if (found && !found->del) {
+    resolve(*found);
+  }
+  return found;
+}
+
+// the newest entry for key with its value pointer unresolved. The caller
+// holds the tree lock.
+std::unique_ptr<StringEntry> StringTree::lookup(const std::string& key) {
+  auto it = memtable->entries.find(key);
+  if (it != memtable->entries.end()) {
+    return std::make_unique<StringEntry>(it->second);
+  }
+  for (auto mem = immutables.rbegin(); mem != immutables.rend(); ++mem) {
+    auto sealed = (*mem)->entries.find(key);
+    if (sealed != (*mem)->entries.end()) {
+      return std::make_unique<StringEntry>(sealed->second);
+    }
+  }
+  for (auto& tables : levels) {
+    for (auto table = tables.rbegin(); table != tables.rend(); ++table) {
+      std::unique_ptr<StringEntry> found = (*table)->get(key);
+      if (found) {
+        return found;
+      }
+    }
+  }
+  return nullptr;
+}
+
+std::vector<StringEntry> StringTree::range(const std::string& lower,
+                                           const std::string& upper,
+                                           size_t limit) {
+  std::shared_lock<std::shared_mutex> lock(tree_mutex);
+  // the memtables, newest first.
+  std::vector<const MemTable*> mems{memtable.get()};
+  for (auto mem = immutables.rbegin(); mem != immutables.rend(); ++mem) {
+    mems.push_back(mem->get());
+  }
+  std::vector<std::vector<StringEntry>> mem_entries(mems.size());
+  std::vector<StringSource> sources;
+  for (size_t i = 0; i < mems.size(); i++) {
+    for (auto it = mems[i]->entries.lower_bound(lower);
+         it != mems[i]->entries.end() && it->first <= upper; ++it) {
+      mem_entries[i].push_back(it->second);
+    }
+    sources.emplace_back(mem_entries[i]);
+  }
+  for (auto& tables : levels) {
+    for (auto table = tables.rbegin(); table != tables.rend(); ++table) {
+      sources.emplace_back(table->get());
+    }
+  }
+
+  std::vector<StringEntry> ret;
+  StringMergingIterator it(std::move(sources));
+  for (it.seek(lower); it.valid() && it.entry().key <= upper; it.next()) {
+    if (it.entry().del) {
+      continue;
+    }
+    ret.push_back(it.entry());
+    if (limit > 0 && ret.size() >= limit) {
+      break;
+    }
+  }
+  resolve_all(ret);
+  return ret;
+}
+
+// replace a value pointer by the value it points to.
+void StringTree::resolve(StringEntry& entry) {
+  if (entry.indirect) {
+    entry.val = vlog.read(entry.val, entry.key);
+    entry.indirect = false;
+  }
+}
+
+// resolve every pointer of a scan. Long scans split the pointers into chunks
+// that are read in parallel on the pool, so the value log reads overlap
+// instead of following one another.
+void StringTree::resolve_all(std::vector<StringEntry>& entries) {
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].indirect) {
+      pending.push_back(i);
+    }
+  }
+  if (!pool || pending.size() < 2 * VALUE_PREFETCH_CHUNK) {
+    for (size_t i : pending) {
+      resolve(entries[i]);
+    }
+    return;
+  }
+
+  std::vector<std::future<void>> futures;
+  for (size_t start = 0; start < pending.size();
+       start += VALUE_PREFETCH_CHUNK) {
+    size_t end = std::min(start + VALUE_PREFETCH_CHUNK, pending.size());
+    futures.push_back(pool->enqueue([this, &entries, &pending, start, end]() {
+      for (size_t i = start; i < end; i++) {
+        resolve(entries[pending[i]]);
+      }
+    }));
+  }
+  // every chunk refers to entries, so all of them finish before an error is
+  // passed on.
+  for (auto& future : futures) {
+    future.wait();
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+}
+
+/**
+ * StringTree flush_loop
+ * The background thread that writes the sealed memtables to level 0, oldest
+ * first, and runs the compactions the new tables make due.
+ */
+void StringTree::flush_loop() {
+  std::unique_lock<std::shared_mutex> lock(tree_mutex);
+  while (true) {
+    flush_cv.wait(lock, [this] { return stop_flush || !immutables.empty(); });
+    if (stop_flush) {
+      return;
+    }
+    std::shared_ptr<const MemTable> mem = immutables.front();
+    lock.unlock();
+    try {
+      flush(*mem);
+      for (size_t level = 0; level < levels.size(); level++) {
+        if (levels[level].size() >= level_ratio) {
+          compact_level(level);
+        }
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "String table flush failed: " << e.what() << std::endl;
+      lock.lock();
+      // the memtable stays sealed; try again later instead of spinning.
+      flush_cv.wait_for(lock, std::chrono::milliseconds(gc_interval_ms));
+      continue;
+    }
+    lock.lock();
+  }
+}
+
+// write the oldest sealed memtable to a new table at level 0 and delete its
+// log segments. Runs on the flush thread, which takes the tree lock only to
+// put the table in place of the memtable.
+void StringTree::flush(const MemTable& mem) {
+  std::vector<StringEntry> entries;
+  entries.reserve(mem.entries.size());
+  for (auto& kv : mem.entries) {
+    entries.push_back(kv.second);
+  }
+  // separate the large values; they must be durable before the table that
+  // points to them is logged.
+  bool separated = false;
+  for (auto& entry : entries) {
+    if (value_log_threshold >= 0 && !entry.del && !entry.indirect &&
+        entry.val.size() >= static_cast<size_t>(value_log_threshold)) {
+      entry.val = vlog.append(entry.key, entry.val);
+      entry.indirect = true;
+      separated = true;
+    }
+  }
+  if (separated) {
+    vlog.sync();
+  }
+  std::set<uint64_t> segments;  // the value log segments the table uses
+  for (auto& entry : entries) {
+    if (entry.indirect) {
+      segments.insert(ValueLog::segment_of(entry.val));
+    }
+  }
+  std::vector<StringSource> sources;
+  sources.emplace_back(entries);
+  bool bottom = true;
+  for (auto& tables : levels) {
+    bottom = bottom && tables.empty();
+  }
+  auto table = write_table(sources, entries.size(), 0, bottom);
+
+  {
+    std::lock_guard<std::mutex> version_lock(version_mutex);
+    VersionEdit edit;
+    if (table) {
+      edit.add_run(0, table->get_file_location());
+    }
+    for (uint64_t seq : segments) {
+      edit.vlog_ref(seq);
+    }
+    log_dead_bytes(edit);
+    if (!edit.empty()) {
+      manifest->append(edit.encode());
+    }
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    if (table) {
+      levels[0].push_back(table);
+    }
+    immutables.pop_front();
+  }
+  room_cv.notify_all();
+  for (uint64_t seq : mem.log_seqs) {
+    WriteAheadLog::remove_segment(seq, WAL_PREFIX);
+  }
+}
+
+// merge every table of a level into one table on the level below. Runs on
+// the flush thread, like flush.
+void StringTree::compact_level(size_t level) {
+  std::vector<std::shared_ptr<StringTable>> inputs = levels[level];
+  std::vector<StringSource> sources;
+  size_t expected = 0;
+  for (auto table = inputs.rbegin(); table != inputs.rend(); ++table) {
+    sources.emplace_back(table->get());
+    expected += (*table)->entry_count();
+  }
+  // tombstones can go only if no older table is left to hide.
+  bool bottom = true;
+  for (size_t below = level + 1; below < levels.size(); below++) {
+    bottom = bottom && levels[below].empty();
+  }
+  auto table = write_table(sources, expected, level + 1, bottom,
+                           compaction_limiter);
+
+  {
+    std::lock_guard<std::mutex> version_lock(version_mutex);
+    VersionEdit edit;
+    for (auto& input : inputs) {
+      edit.remove_run(level, input->get_file_location());
+    }
+    if (table) {
+      edit.add_run(level + 1, table->get_file_location());
+    }
+    log_dead_bytes(edit);
+    manifest->append(edit.encode());
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    if (levels.size() <= level + 1) {
+      levels.resize(level + 2);
+    }
+    levels[level].erase(levels[level].begin(),
+                        levels[level].begin() + inputs.size());
+    if (table) {
+      levels[level + 1].push_back(table);
+    }
+  }
+  for (auto& input : inputs) {
+    std::filesystem::remove(input->get_file_location());
+  }
+  // the merge may have left a value log segment mostly garbage.
+  gc_cv.notify_all();
+}
+
+// merge the sources into a new table for the given level. Returns nullptr if
+// nothing was left to write.
+std::shared_ptr<StringTable> StringTree::write_table(
+    std::vector<StringSource>& sources,
+    size_t expected_entries,
+    size_t level,
+    bool drop_tombstones,
+    RateLimiter* limiter) {
+  /*Base on MONKEY, total_bits = -entries*ln(FPR)/(ln(2)^2)*/
+  float cur_FPR = bloom_bits_per_entry * pow(level_ratio, level);
+  float bloom_bits = ceil(-(log(cur_FPR) / (pow(log(2), 2))));
+  if (bloom_bits <= 5) {
+    bloom_bits = 5;
+  }
+
+  std::string file_name = new_table_name();
+  size_t written;
+  {
+    StringTableWriter writer(file_name, expected_entries, bloom_bits,
+                             limiter);
+    StringMergingIterator it(std::move(sources));
+    // older versions are gone once the merge is written; their values
+    // become garbage in the value log.
+    it.set_shadowed_callback([this](const StringEntry& entry) {
+      if (entry.indirect) {
+        vlog.discard(entry.val);
+      }
+    });
+    for (; it.valid(); it.next()) {
+      if (!drop_tombstones || !it.entry().del) {
+        writer.add(it.entry());
+      }
+    }
+    writer.finish();
+    written = writer.count();
+  }
+  if (written == 0) {
+    std::filesystem::remove(file_name);
+    return nullptr;
+  }
+  sync_path(file_name);
+  return std::make_shared<StringTable>(file_name);
+}
+
+void StringTree::gc_loop() {
+  std::unique_lock<std::mutex> lock(gc_mutex);
+  while (!stop_gc) {
+    gc_cv.wait_for(lock, std::chrono::milliseconds(gc_interval_ms));
+    uint64_t seq;
+    while (!stop_gc && (seq = vlog.collectable(gc_dead_ratio)) != 0) {
+      lock.unlock();
+      try {
+        collect_garbage(seq);
+      } catch (const std::exception& e) {
+        std::cerr << "Value log garbage collection failed: " << e.what()
+                  << std::endl;
+        lock.lock();
+        break;
+      }
+      lock.lock();
+    }
+  }
+}
+
+/**
+ * StringTree collect_garbage
+ * Copies the values of a segment that are still the current value of their
+ * key to the head of the value log, points the keys at the copies through
+ * the memtable and its log, and deletes the segment. A key written again
+ * while the copies were made keeps its new value.
+ */
+void StringTree::collect_garbage(uint64_t seq) {
+  // every intact record of the segment, and the pointer to it.
+  std::vector<StringEntry> records;
+  std::vector<std::string> pointers;
+  vlog.scan(seq, [&](const std::string& key, const std::string& val,
+                     const std::string& pointer) {
+    records.push_back({key, val, false});
+    pointers.push_back(pointer);
+  });
+
+  std::vector<size_t> live;
+  {
+    std::shared_lock<std::shared_mutex> lock(tree_mutex);
+    for (size_t i = 0; i < records.size(); i++) {
+      auto current = lookup(records[i].key);
+      if (current && current->indirect && current->val == pointers[i]) {
+        live.push_back(i);
+      }
+    }
+  }
+  std::vector<std::string> moved;
+  for (size_t i : live) {
+    moved.push_back(vlog.append(records[i].key, records[i].val));
+  }
+  vlog.sync();
+
+  {
+    std::unique_lock<std::shared_mutex> lock(tree_mutex);
+    for (size_t j = 0; j < live.size(); j++) {
+      const std::string& key = records[live[j]].key;
+      auto current = lookup(key);
+      if (current && current->indirect &&
+          current->val == pointers[live[j]]) {
+        StringEntry entry{key, moved[j], false, true};
+        append_log(entry);
+        upsert(entry);
+      } else {
+        vlog.discard(moved[j]);
+      }
+    }
+    // the new pointers are durable before the old values go.
+    wal->sync();
+    if (memtable->size >= memtable_bytes) {
+      seal_memtable(lock);
+    }
+  }
+  // logged first, so a crash before the delete still drops the segment.
+  {
+    std::lock_guard<std::mutex> version_lock(version_mutex);
+    VersionEdit edit;
+    edit.vlog_drop(seq);
+    log_dead_bytes(edit);
+    manifest->append(edit.encode());
+  }
+  vlog.remove(seq);
+}
+
+// add the garbage counts changed since the last edit, so they are replayed
+// after a crash like the tables that made the garbage.
+void StringTree::log_dead_bytes(VersionEdit& edit) {
+  for (auto& seg : vlog.take_dirty()) {
+    edit.vlog_dead(seg.first, seg.second);
+  }
+}
+
+std::string StringTree::new_table_name() {
+  return "lsm_tree_str_" + std::to_string(next_table_id++) + ".sst";
+}
+
+void StringTree::manifest_snapshot() {
+  std::ostringstream config;
+  config << "config " << bloom_bits_per_entry << " " << level_ratio << " "
+         << memtable_bytes << "\n"
+         << "vlog_tracked\n";
+  VersionEdit edit;
+  for (uint64_t seq : vlog.segment_seqs()) {
+    edit.vlog_ref(seq);
+  }
+  vlog.take_dirty();  // the snapshot holds every count.
+  for (auto& seg : vlog.dead_bytes()) {
+    edit.vlog_dead(seg.first, seg.second);
+  }
+  for (size_t level = 0; level < levels.size(); level++) {
+    for (auto& table : levels[level]) {
+      edit.add_run(level, table->get_file_location());
+    }
+  }
+  manifest->rewrite({config.str(), edit.encode()});
+}
+
+void StringTree::exit_save() {
+  std::lock_guard<std::mutex> version_lock(version_mutex);
+  std::unique_lock<std::shared_mutex> lock(tree_mutex);
+  vlog.sync();
+  if (wal) {
+    wal->sync();
+  }
+  if (manifest) {
+    manifest_snapshot();
+  }
+}
+
+std::string StringTree::print() {
+  std::shared_lock<std::shared_mutex> lock(tree_mutex);
+  std::ostringstream oss;
+  oss << "String tables:" << std::endl;
+  for (size_t level = 0; level < levels.size(); level++) {
+    oss << level << ": " << std::endl;
+    for (auto& table : levels[level]) {
+      oss << table->get_file_location() << " " << table->entry_count()
+          << std::endl;
+    }
+    oss << " -> end level." << std::endl;
+  }
+  return oss.str();
+}
@@ -0,0 +1,176 @@
+// This class implements a second, smaller LSM tree for string keys and
+// values, next to the fixed-width integer tree in lsm_tree.h. Writes go to a
+// sorted memtable and a log. A full memtable is sealed and handed to a
+// background thread, which writes it to a string table (see string_table.h)
+// at level 0 while the writers fill a new memtable; the sealed memtables
+// stay readable until their table is in place. Levels are tiered: once a
+// level holds level_ratio tables the same thread merges them into one table
+// on the next level, and tombstones are dropped when the merge writes the
+// bottom level. Tables are written without the tree lock, which is only
+// taken to swap the new table lists in. Each level gets the bloom filter
+// size MONKEY gives it, and compactions are paced by the integer tree's
+// compaction rate limiter.
+//
+// Values of value_log_threshold bytes or more are separated from their keys
+// when the memtable is flushed: they are appended to the value log (see
+// value_log.h) and the tables store a pointer, so compactions never copy
+// them again. A background thread collects value log segments that are
+// mostly garbage, moving their live values to the head of the log and
+// writing the new pointers through the memtable.
+//
+// Structure changes are logged to their own manifest,
+// lsm_tree_str_MANIFEST.log, with the same records as the integer tree
+// (add_run/remove_run) plus
+//   vlog_dead <segment> <bytes>  (carried by every edit that changed it)
+//   vlog_ref <segment>           (a flushed table points into the segment)
+//   vlog_drop <segment>          (garbage collection emptied the segment)
+//   vlog_tracked                 (the vlog_ref lines are complete)
+// so recovery can delete the value log segments nothing points to. Each
+// memtable logs to its own write-ahead log segments
+// lsm_tree_str_wal_<seq>.log (see wal.h), one record
+//   [varint key length][key]
+//   [varint value length << 2 | indirect << 1 | del][value]
+// per write, deleted once the memtable's table is logged. Writes are synced
+// with the same policy and group commit as the integer tree's log.
+#pragma once
+#ifndef STRING_TREE_H
+#define STRING_TREE_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "key_value.h"
+#include "lib/ThreadPool.h"
+#include "manifest.h"
+#include "string_table.h"
+#include "value_log.h"
+#include "wal.h"
+
+class StringTree {
+  // the entries of a memtable and the log segments that hold them.
+  struct MemTable {
+    std::map<std::string, StringEntry> entries;
+    size_t size = 0;  // bytes of keys and values
+    std::vector<uint64_t> log_seqs;
+  };
+
+  float bloom_bits_per_entry;  // base false positive rate, as in LSM_Tree
+  size_t level_ratio;
+  size_t memtable_bytes;  // flush once the keys and values reach this size
+  ThreadPool* pool;  // resolves value pointers of long ranges, may be nullptr
+  // paces the table writes of compactions, may be nullptr.
+  RateLimiter* compaction_limiter;
+
+  // values at least this long go to the value log; -1 keeps them inline.
+  int value_log_threshold = 64;
+  size_t value_log_segment_bytes = 4 << 20;
+  // a sealed segment is collected once this share of it is garbage.
+  double gc_dead_ratio = 0.5;
+  int gc_interval_ms = 1000;
+  // pointers resolved per pool task in range.
+  static const size_t VALUE_PREFETCH_CHUNK = 32;
+
+  // sealed memtables a writer lets queue up before it waits for a flush.
+  static const size_t MAX_IMMUTABLES = 2;
+
+  mutable std::shared_mutex tree_mutex;
+  std::shared_ptr<MemTable> memtable;
+  // sealed memtables, oldest first. They no longer change, so the flush
+  // thread reads them without the lock.
+  std::deque<std::shared_ptr<const MemTable>> immutables;
+  // tables per level, oldest first. Only the flush thread changes them
+  // after recovery, so it reads them without the lock.
+  std::vector<std::vector<std::shared_ptr<StringTable>>> levels;
+
+  // orders the manifest edits with the table lists they describe. Taken
+  // before tree_mutex, never while holding it.
+  std::mutex version_mutex;
+  std::unique_ptr<Manifest> manifest;
+  std::unique_ptr<WriteAheadLog> wal;
+  WriteAheadLog::SyncMode wal_sync_mode;
+  int wal_group_commit_ms;
+  size_t wal_group_commit_entries;
+  uint64_t next_table_id = 1;
+
+  std::thread flush_thread;
+  std::condition_variable_any flush_cv;  // a memtable was sealed
+  std::condition_variable_any room_cv;   // a sealed memtable was flushed
+  bool stop_flush = false;
+
+  ValueLog vlog;
+  std::thread gc_thread;
+  std::mutex gc_mutex;
+  std::condition_variable gc_cv;
+  bool stop_gc = false;
+
+  static const char* manifest_name() { return "lsm_tree_str_MANIFEST.log"; }
+  static constexpr const char* WAL_PREFIX = "lsm_tree_str_wal_";
+
+  void apply(const StringEntry& entry);
+  void upsert(const StringEntry& entry, bool count_garbage = true);
+  uint64_t append_log(const StringEntry& entry);
+  void replay_logs();
+  void replay_log(uint64_t seq);
+  void seal_memtable(std::unique_lock<std::shared_mutex>& lock);
+
+  std::unique_ptr<StringEntry> lookup(const std::string& key);
+  void resolve(StringEntry& entry);
+  void resolve_all(std::vector<StringEntry>& entries);
+  void gc_loop();
+  void collect_garbage(uint64_t seq);
+
+  void flush_loop();
+  void flush(const MemTable& mem);
+  void compact_level(size_t level);
+  std::shared_ptr<StringTable> write_table(std::vector<StringSource>& sources,
+                                           size_t expected_entries,
+                                           size_t level,
+                                           bool drop_tombstones,
+                                           RateLimiter* limiter = nullptr);
+  void log_dead_bytes(VersionEdit& edit);
+  std::string new_table_name();
+  void manifest_snapshot();
+  void remove_orphan_files();
+
+ public:
+  StringTree(float bits_ratio,
+             size_t level_ratio,
+             size_t memtable_bytes,
+             ThreadPool* pool = nullptr,
+             RateLimiter* compaction_limiter = nullptr,
+             WriteAheadLog::SyncMode wal_sync_mode = WriteAheadLog::GROUP,
+             int wal_group_commit_ms = 0,
+             size_t wal_group_commit_entries = 1000);
+  ~StringTree();
+
+  StringTree(const StringTree&) = delete;
+  StringTree& operator=(const StringTree&) = delete;
+
+  // reopen the tables and value log left by an earlier process, replay its
+  // memtable logs and start the flush thread and the value log garbage
+  // collector. Call once, before the first read or write.
+  void recover();
+
+  void put(const std::string& key, const std::string& val);
+  void del(const std::string& key);
+  // the newest entry for key, or nullptr. A deleted key returns its
+  // tombstone.
+  std::unique_ptr<StringEntry> get(const std::string& key);
+  // live entries with lower <= key <= upper, in key order.
+  std::vector<StringEntry> range(const std::string& lower,
+                                 const std::string& upper,
+                                 size_t limit = 0);
+
+  void exit_save();
+  // the tables of every level, for LSM_Tree::print.
+  std::string print();
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <string>
 #include "lib/httplib.h"
 
+#include <condition_variable>
 #include <filesystem>
 #include <iostream>
 #include <mutex>
@@ -17,12 +18,16 @@ struct Task {
 /********************************************************
  *      setting up data structure for a task queue
  ********************************************************/
-// Thread-safe queue for tasks
+// Thread-safe queue for tasks. Workers sleep on a condition variable until a
+// task arrives instead of polling.
 class MyTaskQueue {
  public:
   void push(Task task) {  // this will add a single task at a time.
-    std::lock_guard<std::mutex> lock(m_mutex);
-    m_queue.push(task);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push(task);
+    }
+    m_cv.notify_one();
   }
 
   bool pop(Task& task) {  // this should pop one task at a time.
@@ -35,6 +40,28 @@ class MyTaskQueue {
     return true;
   }
 
+  // block until a task is available. Returns false once the queue has been
+  // shut down and every remaining task was handed out.
+  bool wait_pop(Task& task) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_shutdown || !m_queue.empty(); });
+    if (m_queue.empty()) {
+      return false;
+    }
+    task = m_queue.front();
+    m_queue.pop();
+    return true;
+  }
+
+  // wake every waiting worker so it can exit.
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_shutdown = true;
+    }
+    m_cv.notify_all();
+  }
+
   // New function to print all tasks
   void printAndRestore() {
     std::lock_guard<std::mutex> lock(m_mutex);
@@ -53,4 +80,6 @@ class MyTaskQueue {
  private:
   
   std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_shutdown = false;
 };
@@ -0,0 +1,368 @@
+// This class implements the value log of the string tables: large values are
+// appended here once, and the tables only carry a small pointer to them, so
+// compactions move keys and pointers instead of rewriting every value.
+//
+// The log is a series of segments named lsm_tree_str_vlog_<seq>.vlog. New
+// values go to the head segment, which is sealed and replaced by a new one
+// once it reaches segment_bytes. A record is
+//   [uint32 crc32c of the rest][varint key length][key][varint value length]
+//   [value]
+// and a pointer to it is [varint seq][varint offset][varint record size].
+// The key is kept with the value so garbage collection can ask the tree
+// whether the record is still the current value of its key.
+//
+// Every process starts a fresh head segment, so nothing is appended behind
+// a torn tail. The string manifest names the segments the tables and logs
+// may point to, and recover() deletes any other segment it finds: one a
+// garbage collection emptied but crashed before deleting, or one whose
+// values were appended by a flush that never got logged. Records become garbage when the compactions drop the pointers
+// to them; discard() counts those bytes per segment and collectable() picks a
+// sealed segment that is mostly garbage. The counts that changed since the
+// last take_dirty() go into the next manifest edit, so they survive a crash.
+#pragma once
+#ifndef VALUE_LOG_H
+#define VALUE_LOG_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "block_format.h"
+#include "crc32c.h"
+#include "run_file.h"
+
+class ValueLog {
+  struct Segment {
+    int fd = -1;
+    uint64_t size = 0;
+    uint64_t dead_bytes = 0;  // bytes of records no table points to
+  };
+
+  size_t segment_bytes;
+  std::mutex mutex;
+  std::map<uint64_t, Segment> segments;  // every segment, head included
+  std::set<uint64_t> dirty;  // segments whose dead_bytes are not logged yet
+  uint64_t head_seq = 0;
+  bool unsynced = false;
+
+  static std::string segment_name(uint64_t seq) {
+    return "lsm_tree_str_vlog_" + std::to_string(seq) + ".vlog";
+  }
+
+  static std::string encode_pointer(uint64_t seq, uint64_t offset,
+                                    uint64_t size) {
+    std::string pointer;
+    block_format::put_varint(pointer, seq);
+    block_format::put_varint(pointer, offset);
+    block_format::put_varint(pointer, size);
+    return pointer;
+  }
+
+  static void decode_pointer(const std::string& pointer, uint64_t* seq,
+                             uint64_t* offset, uint64_t* size) {
+    const char* p = pointer.data();
+    const char* limit = p + pointer.size();
+    p = block_format::get_varint(p, limit, seq);
+    if (p) p = block_format::get_varint(p, limit, offset);
+    if (p) p = block_format::get_varint(p, limit, size);
+    if (!p || p != limit) {
+      throw CorruptionError("Bad value log pointer");
+    }
+  }
+
+  // parse the record in buf; false if it fails its crc or does not decode.
+  static bool decode_record(const std::string& buf, std::string* key,
+                            std::string* val) {
+    if (buf.size() < sizeof(uint32_t) ||
+        crc32c::value(buf.data() + sizeof(uint32_t),
+                      buf.size() - sizeof(uint32_t)) !=
+            block_format::get_fixed32(buf.data())) {
+      return false;
+    }
+    const char* p = buf.data() + sizeof(uint32_t);
+    const char* limit = buf.data() + buf.size();
+    uint64_t key_len, val_len;
+    p = block_format::get_varint(p, limit, &key_len);
+    if (!p || static_cast<uint64_t>(limit - p) < key_len) {
+      return false;
+    }
+    key->assign(p, key_len);
+    p = block_format::get_varint(p + key_len, limit, &val_len);
+    if (!p || static_cast<uint64_t>(limit - p) != val_len) {
+      return false;
+    }
+    val->assign(p, val_len);
+    return true;
+  }
+
+  static void pread_all(int fd, char* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = ::pread(fd, buf + done, len - done, offset + done);
+      if (n <= 0) {
+        throw CorruptionError("Short read from value log");
+      }
+      done += n;
+    }
+  }
+
+  void open_head(uint64_t seq) {
+    int fd = ::open(segment_name(seq).c_str(), O_RDWR | O_CREAT | O_APPEND,
+                    0644);
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open value log " +
+                               segment_name(seq));
+    }
+    head_seq = seq;
+    segments[seq].fd = fd;
+  }
+
+ public:
+  explicit ValueLog(size_t segment_bytes) : segment_bytes(segment_bytes) {}
+
+  ~ValueLog() {
+    for (auto& seg : segments) {
+      ::close(seg.second.fd);
+    }
+  }
+
+  ValueLog(const ValueLog&) = delete;
+  ValueLog& operator=(const ValueLog&) = delete;
+
+  // open the segments left in the working directory and start a new head.
+  // If live is given, the segments it does not name are deleted instead.
+  void recover(const std::set<uint64_t>* live = nullptr) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::string prefix = "lsm_tree_str_vlog_";
+    uint64_t max_seq = 0;
+    for (const auto& file : std::filesystem::directory_iterator("./")) {
+      std::string name = file.path().filename().string();
+      if (name.rfind(prefix, 0) != 0 || file.path().extension() != ".vlog") {
+        continue;
+      }
+      uint64_t seq = std::stoull(name.substr(prefix.size()));
+      max_seq = std::max(max_seq, seq);
+      if (std::filesystem::file_size(file.path()) == 0 ||
+          (live && !live->count(seq))) {
+        // a head nothing was put in, or an orphan.
+        std::filesystem::remove(file.path());
+        continue;
+      }
+      int fd = ::open(name.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("Unable to open value log " + name);
+      }
+      segments[seq].fd = fd;
+      segments[seq].size = std::filesystem::file_size(file.path());
+    }
+    open_head(max_seq + 1);
+  }
+
+  // the segment a pointer refers to.
+  static uint64_t segment_of(const std::string& pointer) {
+    uint64_t seq, offset, size;
+    decode_pointer(pointer, &seq, &offset, &size);
+    return seq;
+  }
+
+  // every segment, the head included.
+  std::vector<uint64_t> segment_seqs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint64_t> ret;
+    for (auto& seg : segments) {
+      ret.push_back(seg.first);
+    }
+    return ret;
+  }
+
+  // append a value and return the pointer the tables store instead.
+  std::string append(const std::string& key, const std::string& val) {
+    std::string record(sizeof(uint32_t), '\0');
+    block_format::put_varint(record, key.size());
+    record.append(key);
+    block_format::put_varint(record, val.size());
+    record.append(val);
+    uint32_t crc = crc32c::value(record.data() + sizeof(uint32_t),
+                                 record.size() - sizeof(uint32_t));
+    std::memcpy(&record[0], &crc, sizeof(crc));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Segment& head = segments[head_seq];
+    size_t done = 0;
+    while (done < record.size()) {
+      ssize_t n =
+          ::write(head.fd, record.data() + done, record.size() - done);
+      if (n < 0) {
+        throw std::runtime_error("Failed to write to value log");
+      }
+      done += n;
+    }
+    std::string pointer = encode_pointer(head_seq, head.size, record.size());
+    head.size += record.size();
+    unsynced = true;
+    if (head.size >= segment_bytes) {
+      // seal the head; later appends go to a new segment.
+      ::fdatasync(head.fd);
+      unsynced = false;
+      open_head(head_seq + 1);
+    }
+    return pointer;
+  }
+
+  // make every appended value durable. Call before logging the tables or
+  // memtable entries that point to them.
+  void sync() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (unsynced) {
+      ::fdatasync(segments[head_seq].fd);
+      unsynced = false;
+    }
+  }
+
+  // the value a pointer refers to, checked against its crc and key.
+  std::string read(const std::string& pointer, const std::string& key) {
+    uint64_t seq, offset, size;
+    decode_pointer(pointer, &seq, &offset, &size);
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = segments.find(seq);
+      if (it == segments.end() || offset + size > it->second.size) {
+        throw CorruptionError("Value log pointer past the end of " +
+                              segment_name(seq));
+      }
+      fd = it->second.fd;
+    }
+    std::string record(size, '\0');
+    pread_all(fd, &record[0], size, offset);
+    std::string record_key, val;
+    if (!decode_record(record, &record_key, &val) || record_key != key) {
+      throw CorruptionError("Corrupt value at " + std::to_string(offset) +
+                            " of " + segment_name(seq));
+    }
+    return val;
+  }
+
+  // note that the record a pointer refers to is no longer reachable.
+  void discard(const std::string& pointer) {
+    uint64_t seq, offset, size;
+    decode_pointer(pointer, &seq, &offset, &size);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = segments.find(seq);
+    if (it != segments.end()) {
+      it->second.dead_bytes += size;
+      dirty.insert(seq);
+    }
+  }
+
+  // a sealed segment whose garbage is at least dead_ratio of its size, or
+  // 0 if there is none.
+  uint64_t collectable(double dead_ratio) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& seg : segments) {
+      if (seg.first != head_seq && seg.second.size > 0 &&
+          seg.second.dead_bytes >= dead_ratio * seg.second.size) {
+        return seg.first;
+      }
+    }
+    return 0;
+  }
+
+  // call fn(key, value, pointer) for every intact record of a segment.
+  void scan(uint64_t seq,
+            const std::function<void(const std::string&, const std::string&,
+                                     const std::string&)>& fn) {
+    int fd;
+    uint64_t size;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      fd = segments.at(seq).fd;
+      size = segments.at(seq).size;
+    }
+    std::string data(size, '\0');
+    pread_all(fd, &data[0], size, 0);
+
+    uint64_t pos = 0;
+    while (pos + sizeof(uint32_t) < size) {
+      // the record length is only known after the two varints.
+      const char* p = data.data() + pos + sizeof(uint32_t);
+      const char* limit = data.data() + size;
+      uint64_t key_len, val_len;
+      p = block_format::get_varint(p, limit, &key_len);
+      if (!p || static_cast<uint64_t>(limit - p) < key_len) {
+        return;
+      }
+      p = block_format::get_varint(p + key_len, limit, &val_len);
+      if (!p || static_cast<uint64_t>(limit - p) < val_len) {
+        return;  // torn tail.
+      }
+      uint64_t record_size = (p - data.data()) + val_len - pos;
+      std::string key, val;
+      if (!decode_record(data.substr(pos, record_size), &key, &val)) {
+        return;
+      }
+      fn(key, val, encode_pointer(seq, pos, record_size));
+      pos += record_size;
+    }
+  }
+
+  // drop a collected segment.
+  void remove(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = segments.find(seq);
+    if (it == segments.end() || seq == head_seq) {
+      return;
+    }
+    ::close(it->second.fd);
+    segments.erase(it);
+    dirty.erase(seq);
+    std::filesystem::remove(segment_name(seq));
+  }
+
+  // garbage counts per segment, saved in the manifest snapshot because they
+  // cannot be rebuilt without scanning every table.
+  std::map<uint64_t, uint64_t> dead_bytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<uint64_t, uint64_t> ret;
+    for (auto& seg : segments) {
+      if (seg.second.dead_bytes > 0) {
+        ret[seg.first] = seg.second.dead_bytes;
+      }
+    }
+    return ret;
+  }
+
+  // the garbage counts changed since the last call, to be logged with the
+  // next manifest edit.
+  std::map<uint64_t, uint64_t> take_dirty() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<uint64_t, uint64_t> ret;
+    for (uint64_t seq : dirty) {
+      auto it = segments.find(seq);
+      if (it != segments.end()) {
+        ret[seq] = it->second.dead_bytes;
+      }
+    }
+    dirty.clear();
+    return ret;
+  }
+
+  void set_dead_bytes(uint64_t seq, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = segments.find(seq);
+    if (it != segments.end()) {
+      it->second.dead_bytes = bytes;
+    }
+  }
+};
+
+#endif
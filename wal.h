@@ -0,0 +1,357 @@
+// This class implements the write-ahead log that protects the buffer level.
+// Every buffer (active or sealed) has its own log segment named
+// lsm_tree_wal_<seq>.log. Sealing a buffer rotates to a new segment, and a
+// segment is deleted once its buffer has been flushed into a run. The
+// string tree logs its memtables the same way, under the prefix
+// lsm_tree_str_wal_.
+//
+// A record is a group of entries applied together:
+//   [uint32 crc32c of the rest][uint32 entry count]
+//   [count x (KEY_t key, VALUE_t val, uint8 del)]
+// or, for the string tree, one opaque write:
+//   [uint32 crc32c of the rest][uint32 byte count][bytes]
+// Replay stops at the first record that is torn or fails its crc.
+//
+// Writers append records to an in-memory buffer under the tree's buffer
+// lock, which numbers them, and then call commit() without that lock. The
+// first writer to find no write in progress becomes the leader: it takes
+// every pending record, writes and syncs them without holding the log
+// mutex, and wakes the writers whose records that covered. Writers that
+// append while it syncs form the next group. A failed write or sync leaves
+// the segment with a hole, so the log is marked failed and every later
+// commit throws instead of reporting records durable that are not.
+#pragma once
+#ifndef WAL_H
+#define WAL_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crc32c.h"
+#include "key_value.h"
+
+class WriteAheadLog {
+ public:
+  // EVERY_WRITE syncs each group as soon as a leader picks it up. GROUP
+  // lets the leader wait up to group_commit_ms for group_commit_entries
+  // records before it syncs, trading latency for fewer syncs. In both, a
+  // write returns once its record is durable. NONE writes the records but
+  // leaves syncing to the OS.
+  enum SyncMode { EVERY_WRITE, GROUP, NONE };
+
+  static const size_t RECORD_ENTRY_SIZE =
+      sizeof(KEY_t) + sizeof(VALUE_t) + sizeof(uint8_t);
+  static const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+  static constexpr const char* DEFAULT_PREFIX = "lsm_tree_wal_";
+
+ private:
+  std::string prefix;  // segments are <prefix><seq>.log
+  SyncMode sync_mode;
+  int group_commit_ms;
+  size_t group_commit_entries;
+
+  std::mutex mutex;
+  std::condition_variable commit_cv;  // wakes writers when a group is done
+
+  int fd = -1;
+  uint64_t active_seq = 0;
+  std::vector<char> pending;  // encoded records not yet written to the fd
+  size_t pending_records = 0;
+  uint64_t last_lsn = 0;     // number of the last record appended
+  uint64_t durable_lsn = 0;  // every record up to this one is written/synced
+  bool leader_active = false;  // a leader is writing outside the mutex
+  bool failed = false;  // a write or sync failed; nothing is durable anymore
+
+  static std::string segment_name(const std::string& prefix, uint64_t seq) {
+    return prefix + std::to_string(seq) + ".log";
+  }
+
+  void open_segment(uint64_t seq) {
+    active_seq = seq;
+    std::string name = segment_name(prefix, seq);
+    fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open write-ahead log " + name);
+    }
+  }
+
+  // read a whole segment, or nothing if it does not exist.
+  static std::vector<char> read_file(const std::string& name) {
+    std::ifstream in(name, std::ios::binary);
+    if (!in.is_open()) {
+      return {};
+    }
+    return std::vector<char>((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+  }
+
+  // fill in the crc of the record that starts at pending[start], number it
+  // and wake a leader waiting for a full group. Caller holds the mutex.
+  uint64_t finish_record(size_t start) {
+    uint32_t crc = crc32c::value(&pending[start + sizeof(uint32_t)],
+                                 pending.size() - start - sizeof(uint32_t));
+    std::memcpy(&pending[start], &crc, sizeof(crc));
+    pending_records++;
+    if (pending_records >= group_commit_entries) {
+      commit_cv.notify_all();  // a waiting leader's group is full
+    }
+    return ++last_lsn;
+  }
+
+  // write buf and optionally sync it; false if either failed.
+  static bool write_out(int out, const std::vector<char>& buf, bool sync) {
+    size_t done = 0;
+    while (done < buf.size()) {
+      ssize_t n = ::write(out, buf.data() + done, buf.size() - done);
+      if (n < 0) {
+        return false;
+      }
+      done += n;
+    }
+    return !sync || ::fdatasync(out) == 0;
+  }
+
+  void check_failed() const {
+    if (failed) {
+      throw std::runtime_error("Write-ahead log failed to write or sync");
+    }
+  }
+
+  // write and optionally sync the pending records while holding the mutex.
+  // Waits out a leader first, so nothing else touches the fd. Used where the
+  // segment changes hands, which is rare.
+  void drain(std::unique_lock<std::mutex>& lock, bool sync) {
+    commit_cv.wait(lock, [this]() { return !leader_active; });
+    check_failed();
+    if (!write_out(fd, pending, sync)) {
+      failed = true;
+      commit_cv.notify_all();
+      check_failed();
+    }
+    pending.clear();
+    pending_records = 0;
+    durable_lsn = last_lsn;
+    commit_cv.notify_all();
+  }
+
+ public:
+  WriteAheadLog(SyncMode mode,
+                int commit_ms,
+                size_t commit_entries,
+                std::string prefix = DEFAULT_PREFIX)
+      : prefix(std::move(prefix)),
+        sync_mode(mode),
+        group_commit_ms(commit_ms),
+        group_commit_entries(std::max<size_t>(commit_entries, 1)) {}
+
+  ~WriteAheadLog() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (fd >= 0) {
+      try {
+        drain(lock, sync_mode != NONE);
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+      }
+      ::close(fd);
+    }
+  }
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+  // sequence numbers of the segments left in the working directory, oldest
+  // first.
+  static std::vector<uint64_t> existing_segments(
+      const std::string& prefix = DEFAULT_PREFIX) {
+    std::vector<uint64_t> ret;
+    for (const auto& file : std::filesystem::directory_iterator("./")) {
+      std::string name = file.path().filename().string();
+      if (name.rfind(prefix, 0) == 0 && file.path().extension() == ".log") {
+        ret.push_back(std::stoull(name.substr(prefix.size())));
+      }
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  }
+
+  // read every complete record of a segment, in order.
+  static std::vector<Entry_t> read_segment(
+      uint64_t seq, const std::string& prefix = DEFAULT_PREFIX) {
+    std::vector<Entry_t> ret;
+    std::vector<char> data = read_file(segment_name(prefix, seq));
+
+    size_t pos = 0;
+    while (pos + RECORD_HEADER_SIZE <= data.size()) {
+      uint32_t crc, cnt;
+      std::memcpy(&crc, &data[pos], sizeof(crc));
+      std::memcpy(&cnt, &data[pos + sizeof(crc)], sizeof(cnt));
+      size_t body = sizeof(cnt) + size_t(cnt) * RECORD_ENTRY_SIZE;
+      if (pos + sizeof(crc) + body > data.size() ||
+          crc32c::value(&data[pos + sizeof(crc)], body) != crc) {
+        break;  // torn or zero-filled write at the tail.
+      }
+      pos += RECORD_HEADER_SIZE;
+      for (uint32_t i = 0; i < cnt; i++) {
+        Entry_t entry;
+        std::memcpy(&entry.key, &data[pos], sizeof(KEY_t));
+        std::memcpy(&entry.val, &data[pos + sizeof(KEY_t)], sizeof(VALUE_t));
+        entry.del = data[pos + sizeof(KEY_t) + sizeof(VALUE_t)] != 0;
+        ret.push_back(entry);
+        pos += RECORD_ENTRY_SIZE;
+      }
+    }
+    return ret;
+  }
+
+  // read every complete opaque record of a segment, in order.
+  static std::vector<std::string> read_raw_segment(
+      uint64_t seq, const std::string& prefix) {
+    std::vector<std::string> ret;
+    std::vector<char> data = read_file(segment_name(prefix, seq));
+
+    size_t pos = 0;
+    while (pos + RECORD_HEADER_SIZE <= data.size()) {
+      uint32_t crc, len;
+      std::memcpy(&crc, &data[pos], sizeof(crc));
+      std::memcpy(&len, &data[pos + sizeof(crc)], sizeof(len));
+      size_t body = sizeof(len) + size_t(len);
+      if (pos + sizeof(crc) + body > data.size() ||
+          crc32c::value(&data[pos + sizeof(crc)], body) != crc) {
+        break;  // torn or zero-filled write at the tail.
+      }
+      ret.emplace_back(&data[pos + RECORD_HEADER_SIZE], len);
+      pos += sizeof(crc) + body;
+    }
+    return ret;
+  }
+
+  static void remove_segment(uint64_t seq,
+                             const std::string& prefix = DEFAULT_PREFIX) {
+    std::filesystem::remove(segment_name(prefix, seq));
+  }
+
+  // start logging into a new segment numbered seq.
+  void open(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(mutex);
+    open_segment(seq);
+  }
+
+  // add a group of entries to the pending records as one record and return
+  // its number, to be passed to commit(). Does no IO, so it can be called
+  // under the lock that orders the writes.
+  uint64_t append(const Entry_t* entries, size_t cnt) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0) {
+      return 0;
+    }
+
+    size_t start = pending.size();
+    pending.resize(start + RECORD_HEADER_SIZE + cnt * RECORD_ENTRY_SIZE);
+    char* body = &pending[start + sizeof(uint32_t)];
+    char* pos = body;
+    uint32_t record_cnt = cnt;
+    std::memcpy(pos, &record_cnt, sizeof(record_cnt));
+    pos += sizeof(record_cnt);
+    for (size_t i = 0; i < cnt; i++) {
+      std::memcpy(pos, &entries[i].key, sizeof(KEY_t));
+      std::memcpy(pos + sizeof(KEY_t), &entries[i].val, sizeof(VALUE_t));
+      pos[sizeof(KEY_t) + sizeof(VALUE_t)] = entries[i].del ? 1 : 0;
+      pos += RECORD_ENTRY_SIZE;
+    }
+    return finish_record(start);
+  }
+
+  // the same for one opaque record.
+  uint64_t append(const std::string& record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0) {
+      return 0;
+    }
+
+    size_t start = pending.size();
+    pending.resize(start + RECORD_HEADER_SIZE);
+    uint32_t len = record.size();
+    std::memcpy(&pending[start + sizeof(uint32_t)], &len, sizeof(len));
+    pending.insert(pending.end(), record.begin(), record.end());
+    return finish_record(start);
+  }
+
+  // block until record lsn is durable, or written for NONE. The caller
+  // either leads a group or waits for the leader that covers its record.
+  void commit(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (durable_lsn < lsn) {
+      check_failed();
+      if (leader_active) {
+        if (sync_mode == NONE) {
+          return;  // the leader writes everything pending before it stops.
+        }
+        commit_cv.wait(lock);
+        continue;
+      }
+
+      leader_active = true;
+      if (sync_mode == GROUP && group_commit_ms > 0) {
+        commit_cv.wait_for(lock, std::chrono::milliseconds(group_commit_ms),
+                           [this]() {
+                             return pending_records >= group_commit_entries;
+                           });
+      }
+      // NONE keeps writing until nothing is pending, since writers that
+      // found it busy did not wait.
+      do {
+        std::vector<char> group;
+        group.swap(pending);
+        pending_records = 0;
+        uint64_t group_lsn = last_lsn;
+        int out = fd;
+
+        lock.unlock();
+        bool written = write_out(out, group, sync_mode != NONE);
+        lock.lock();
+        if (!written) {
+          failed = true;
+          break;
+        }
+        durable_lsn = std::max(durable_lsn, group_lsn);
+      } while (sync_mode == NONE && !pending.empty());
+      leader_active = false;
+      commit_cv.notify_all();
+    }
+  }
+
+  // make the active segment durable and switch to a new one. Returns the
+  // sequence number of the segment that was closed.
+  uint64_t rotate() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t closed = active_seq;
+    drain(lock, sync_mode != NONE);
+    ::close(fd);
+    open_segment(active_seq + 1);
+    return closed;
+  }
+
+  // write and fsync everything logged so far.
+  void sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (fd >= 0) {
+      drain(lock, true);
+    }
+  }
+};
+
+#endif
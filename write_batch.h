@@ -0,0 +1,32 @@
+// This class collects puts and deletes so they can be written to the tree as
+// one unit with LSM_Tree::write. The batch lands in the buffer at once and
+// is logged as a single write-ahead log record, so after a crash either the
+// whole batch is replayed or none of it. Operations on the same key apply in
+// the order they were added.
+#pragma once
+#ifndef WRITE_BATCH_H
+#define WRITE_BATCH_H
+
+#include <vector>
+
+#include "key_value.h"
+
+class WriteBatch {
+  std::vector<Entry_t> entries;
+
+ public:
+  void put(KEY_t key, VALUE_t val) {
+    entries.push_back(Entry_t{key, val, false});
+  }
+
+  // Deletion is done as write with an additional flag.
+  void del(KEY_t key) { entries.push_back(Entry_t{key, 0, true}); }
+
+  void clear() { entries.clear(); }
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+
+  const std::vector<Entry_t>& get_entries() const { return entries; }
+};
+
+#endif